@@ -0,0 +1,250 @@
+#include "../src/include/instructions.h"
+#include "../src/include/intel-8080.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_ITERATIONS 10000000ULL
+
+// Keeps the compiler from hoisting the emulated state out of the benchmark
+// loops, every iteration has to go through memory like the core does
+#define BARRIER() __asm__ volatile("" ::: "memory")
+
+extern uint8_t memory[];
+
+static uint8_t registers[8];
+static uint8_t flags;
+static uint16_t PC;
+static uint8_t bench_memory[65536];
+
+typedef struct result_t {
+    const char* kind;
+    const char* name;
+    uint64_t instructions;
+    // zero when the variant doesn't account for cycles
+    uint64_t cycles;
+    uint64_t ns;
+} result_t;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void report(const result_t* result)
+{
+    const double instructions = (double)result->instructions;
+    printf("%s,%s,%llu,", result->kind, result->name,
+           (unsigned long long)result->instructions);
+    if(result->cycles > 0) {
+        printf("%.3f", (double)result->cycles / instructions);
+    }
+    printf(",%.3f,%.2f\n", (double)result->ns / instructions,
+           instructions * 1000.0 / (double)result->ns);
+}
+
+// Per-opcode microbenchmarks: every handler runs in a tight loop with the
+// operand varying on each iteration. `imm` is available to the call.
+#define MICROBENCH(name, call)                                                 \
+    static void bench_##name(const uint64_t iterations)                        \
+    {                                                                          \
+        uint64_t cycles = 0;                                                   \
+        const uint64_t start = now_ns();                                       \
+        for(uint64_t i = 0; i < iterations; i++) {                             \
+            const uint8_t imm = (uint8_t)i;                                    \
+            (void)imm;                                                         \
+            cycles += (call);                                                  \
+            BARRIER();                                                         \
+        }                                                                      \
+        const result_t result = { "opcode", #name, iterations, cycles,        \
+                                  now_ns() - start };                          \
+        report(&result);                                                       \
+    }
+
+MICROBENCH(MVI_mem, MVI_mem(registers, bench_memory, imm))
+MICROBENCH(LDA, LDA(registers, bench_memory, ADDRESS(0x20, imm)))
+MICROBENCH(STA, STA(registers, bench_memory, ADDRESS(0x20, imm)))
+MICROBENCH(LHLD, LHLD(registers, bench_memory, ADDRESS(0x20, imm)))
+MICROBENCH(SHLD, SHLD(registers, bench_memory, ADDRESS(0x20, imm)))
+MICROBENCH(XCHG, XCHG(registers))
+MICROBENCH(ADD_mem, ADD_mem(registers, bench_memory, &flags))
+MICROBENCH(ADI, ADI(registers, imm, &flags))
+MICROBENCH(ADC_mem, ADC_mem(registers, bench_memory, &flags))
+MICROBENCH(ACI, ACI(registers, imm, &flags))
+MICROBENCH(SUB_mem, SUB_mem(registers, bench_memory, &flags))
+MICROBENCH(SUI, SUI(registers, imm, &flags))
+MICROBENCH(SBB_mem, SBB_mem(registers, bench_memory, &flags))
+MICROBENCH(SBI, SBI(registers, imm, &flags))
+MICROBENCH(INR_mem, INR_mem(registers, bench_memory, &flags))
+MICROBENCH(DCR_mem, DCR_mem(registers, bench_memory, &flags))
+MICROBENCH(DDA, DDA(registers, &flags))
+MICROBENCH(ANA_mem, ANA_mem(registers, bench_memory, &flags))
+MICROBENCH(ANI, ANI(registers, imm, &flags))
+MICROBENCH(XRA_mem, XRA_mem(registers, bench_memory, &flags))
+MICROBENCH(XRI, XRI(registers, imm, &flags))
+MICROBENCH(ORA_mem, ORA_mem(registers, bench_memory, &flags))
+MICROBENCH(ORI, ORI(registers, imm, &flags))
+MICROBENCH(CMP_mem, CMP_mem(registers, bench_memory, &flags))
+MICROBENCH(CPI, CPI(registers, imm, &flags))
+MICROBENCH(RLC, RLC(registers, &flags))
+MICROBENCH(RRC, RRC(registers, &flags))
+MICROBENCH(RAL, RAL(registers, &flags))
+MICROBENCH(RAR, RAR(registers, &flags))
+MICROBENCH(CMA, CMA(registers))
+MICROBENCH(CMC, CMC(&flags))
+MICROBENCH(STC, STC(&flags))
+MICROBENCH(JMP, JMP(imm, 0x20, &PC))
+
+// Whole-program runs through cpu_run(). Every program starts with
+// LHLD 0100h so that memory operands (HL = 0080h) stay clear of the code,
+// then loops from 0003h back to itself with a JMP.
+// NOTE: The standard exercisers (CPUDIAG, TST8080, 8080PRE, 8080EXM) need
+// CALL/RET, MOV/MVI and the rest of the instruction set, add them here once
+// the core implements them.
+typedef struct program_t {
+    const char* name;
+    const uint8_t* code;
+    size_t size;
+} program_t;
+
+#define DATA_START 0x0100
+
+static const uint8_t alu_program[] = {
+    0x2A, 0x00, 0x01, // LHLD 0100h
+    0xC6, 0x01,       // ADI 01h
+    0xCE, 0x02,       // ACI 02h
+    0xD6, 0x03,       // SUI 03h
+    0xDE, 0x01,       // SBI 01h
+    0x86,             // ADD M
+    0x96,             // SUB M
+    0xFE, 0x40,       // CPI 40h
+    0xC3, 0x03, 0x00, // JMP 0003h
+};
+
+static const uint8_t logic_program[] = {
+    0x2A, 0x00, 0x01, // LHLD 0100h
+    0xE6, 0xF7,       // ANI F7h
+    0xF6, 0x11,       // ORI 11h
+    0xEE, 0x5A,       // XRI 5Ah
+    0x07,             // RLC
+    0x0F,             // RRC
+    0x17,             // RAL
+    0x1F,             // RAR
+    0x2F,             // CMA
+    0x3F,             // CMC
+    0x37,             // STC
+    0xC3, 0x03, 0x00, // JMP 0003h
+};
+
+static const uint8_t memory_program[] = {
+    0x2A, 0x00, 0x01, // LHLD 0100h
+    0x36, 0x42,       // MVI M, 42h
+    0x34,             // INR M
+    0x35,             // DCR M
+    0x32, 0x90, 0x00, // STA 0090h
+    0x3A, 0x90, 0x00, // LDA 0090h
+    0x22, 0x92, 0x00, // SHLD 0092h
+    0x2A, 0x00, 0x01, // LHLD 0100h
+    0x86,             // ADD M
+    0xC3, 0x03, 0x00, // JMP 0003h
+};
+
+static const program_t programs[] = {
+    { "alu", alu_program, sizeof(alu_program) },
+    { "logic", logic_program, sizeof(logic_program) },
+    { "memory", memory_program, sizeof(memory_program) },
+};
+
+// Instructions and cycles are what the core counted, a step is a clock
+// cycle for the accurate variant and an instruction for the fast one.
+// `stepped` drives the core through cpu_step() instead of cpu_run().
+static void bench_program(const program_t* program, const uint64_t steps,
+                          const uint8_t variant, const bool stepped,
+                          const char* name)
+{
+    memset(memory, 0, DATA_START + 2);
+    memcpy(memory, program->code, program->size);
+    memory[DATA_START] = 0x80;
+    memory[DATA_START + 1] = 0x00;
+    cpu_init();
+    cpu_set_variant(variant);
+
+    const uint64_t start = now_ns();
+    if(stepped) {
+        for(uint64_t i = 0; i < steps; i++) {
+            cpu_step();
+        }
+    } else {
+        cpu_run(steps);
+    }
+    const result_t result = { "program", name, cpu_instruction_count(),
+                              cpu_cycle_count(), now_ns() - start };
+    report(&result);
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t iterations = DEFAULT_ITERATIONS;
+    if(argc > 1) {
+        iterations = strtoull(argv[1], NULL, 10);
+        if(iterations == 0) {
+            fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("kind,name,instructions,cycles_per_instruction,"
+           "ns_per_instruction,mips\n");
+
+    bench_MVI_mem(iterations);
+    bench_LDA(iterations);
+    bench_STA(iterations);
+    bench_LHLD(iterations);
+    bench_SHLD(iterations);
+    bench_XCHG(iterations);
+    bench_ADD_mem(iterations);
+    bench_ADI(iterations);
+    bench_ADC_mem(iterations);
+    bench_ACI(iterations);
+    bench_SUB_mem(iterations);
+    bench_SUI(iterations);
+    bench_SBB_mem(iterations);
+    bench_SBI(iterations);
+    bench_INR_mem(iterations);
+    bench_DCR_mem(iterations);
+    bench_DDA(iterations);
+    bench_ANA_mem(iterations);
+    bench_ANI(iterations);
+    bench_XRA_mem(iterations);
+    bench_XRI(iterations);
+    bench_ORA_mem(iterations);
+    bench_ORI(iterations);
+    bench_CMP_mem(iterations);
+    bench_CPI(iterations);
+    bench_RLC(iterations);
+    bench_RRC(iterations);
+    bench_RAL(iterations);
+    bench_RAR(iterations);
+    bench_CMA(iterations);
+    bench_CMC(iterations);
+    bench_STC(iterations);
+    bench_JMP(iterations);
+
+    for(size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "%s-accurate", programs[i].name);
+        bench_program(&programs[i], iterations, CPU_VARIANT_ACCURATE, false,
+                      name);
+        snprintf(name, sizeof(name), "%s-fast", programs[i].name);
+        bench_program(&programs[i], iterations, CPU_VARIANT_FAST, false, name);
+        // The per-cycle API the rest of the machine is driven with
+        snprintf(name, sizeof(name), "%s-accurate-step", programs[i].name);
+        bench_program(&programs[i], iterations, CPU_VARIANT_ACCURATE, true,
+                      name);
+    }
+
+    return 0;
+}
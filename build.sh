@@ -1,3 +1,28 @@
 #!/bin/bash
 
-gcc src/intel-8080.c -Wall -Wextra -Werror -pedantic -o intel-8080.out
+CFLAGS="-std=gnu2x -Wall -Wextra -Werror -pedantic"
+SOURCES="src/intel-8080.c src/bdos.c src/video.c"
+
+# The optional second argument picks the video kernel to compile: avx2,
+# scalar, or the compiler's default (SSE2 on x86-64)
+case "$2" in
+    avx2)
+        CFLAGS="$CFLAGS -mavx2"
+        ;;
+    scalar)
+        CFLAGS="$CFLAGS -mno-sse2"
+        ;;
+esac
+
+case "$1" in
+    bench)
+        gcc $SOURCES bench/bench.c $CFLAGS -O2 -o bench.out
+        ;;
+    conformance)
+        gcc $SOURCES conformance/conformance.c $CFLAGS -O2 -pthread \
+            -o conformance.out
+        ;;
+    *)
+        gcc $SOURCES $CFLAGS -o intel-8080.out
+        ;;
+esac
@@ -0,0 +1,1393 @@
+#include "../src/include/bdos.h"
+#include "../src/include/instructions.h"
+#include "../src/include/intel-8080.h"
+#include "../src/include/video.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Exerciser style conformance runner: every group drives one instruction
+// class through all operand values and a set of input flags and compares
+// each result against an independent model of the 8080. Groups are
+// independent and run concurrently, each on its own machine state.
+
+#define MISMATCH_SIZE 224
+
+// The handlers don't wrap address + 1 for LHLD and SHLD, the extra byte
+// keeps them in bounds. The reference model does wrap.
+#define MACHINE_MEMORY_SIZE (65536 + 1)
+
+typedef struct machine_t {
+    uint8_t registers[8];
+    uint8_t flags;
+    uint16_t PC;
+    uint8_t memory[MACHINE_MEMORY_SIZE];
+} machine_t;
+
+typedef struct group_t {
+    const char* name;
+    void (*run)(struct group_t* group, machine_t* machine);
+    // runs on the global CPU, only one such group at a time
+    bool uses_core;
+    // known deviations of the handlers, see groups[]
+    uint64_t known_mismatches;
+    uint64_t known_fingerprint;
+    uint64_t cases;
+    uint64_t mismatches;
+    uint64_t fingerprint;
+    char first_mismatch[MISMATCH_SIZE];
+} group_t;
+
+// carry and auxiliary carry are the only flags read by the instructions, the
+// last entry checks that untouched flags are preserved
+static const uint8_t input_flags[] = { 0x02, 0x03, 0x12, 0x13, 0xD7 };
+
+// Memory operands are addressed through HL, H must take part in the address.
+// Video RAM is included since the hooks variants track writes to it.
+static const uint16_t hl_addresses[]
+    = { 0x0080, 0x2400, 0x2A5F, 0x3FFF, 0x7F81, 0xC0DE, 0xFFFE };
+
+#define HL_ADDRESS_COUNT (sizeof(hl_addresses) / sizeof(hl_addresses[0]))
+
+#define FNV_OFFSET 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+static uint64_t fingerprint_bytes(uint64_t hash, const void* data,
+                                  const size_t size)
+{
+    const uint8_t* bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static uint64_t fingerprint_string(const uint64_t hash, const char* string)
+{
+    return fingerprint_bytes(hash, string, strlen(string) + 1);
+}
+
+static void check(group_t* group, const bool passed, const char* name,
+                  const int a, const int b, const uint8_t flags_in,
+                  const char* got, const char* expected)
+{
+    group->cases++;
+    if(passed) {
+        return;
+    }
+    if(group->mismatches == 0) {
+        snprintf(group->first_mismatch, MISMATCH_SIZE,
+                 "%s a=%02x b=%02x f=%02x: got %s, expected %s", name, a, b,
+                 flags_in, got, expected);
+        group->fingerprint = FNV_OFFSET;
+    }
+    group->mismatches++;
+
+    // Every mismatching case goes into the fingerprint, in order, so that a
+    // new deviation is caught even inside a group with known ones
+    const uint8_t inputs[] = { (uint8_t)a, (uint8_t)b, flags_in };
+    uint64_t hash = fingerprint_string(group->fingerprint, name);
+    hash = fingerprint_bytes(hash, inputs, sizeof(inputs));
+    hash = fingerprint_string(hash, got);
+    group->fingerprint = fingerprint_string(hash, expected);
+}
+
+// Reference model of the 8080 ALU, written from the data sheet rather than
+// from the handlers
+
+typedef struct alu_result_t {
+    uint8_t A;
+    uint8_t flags;
+    uint8_t memory;
+    uint8_t cycles;
+} alu_result_t;
+
+static uint8_t sign_zero_parity(const uint8_t result)
+{
+    uint8_t bits = 0;
+    for(int i = 0; i < 8; i++) {
+        bits += (result >> i) & 1;
+    }
+
+    uint8_t out = result & SIGN_FLAG;
+    if(result == 0) {
+        out |= ZERO_FLAG;
+    }
+    if(bits % 2 == 0) {
+        out |= PARITY_FLAG;
+    }
+    return out;
+}
+
+static uint8_t merge_flags(const uint8_t flags, const uint8_t mask,
+                           const uint8_t values)
+{
+    return (uint8_t)((flags & ~mask) | (values & mask));
+}
+
+static alu_result_t reference_add(const uint8_t a, const uint8_t b,
+                                  const uint8_t flags, const uint8_t carry)
+{
+    const unsigned sum = a + b + carry;
+    const uint8_t result = (uint8_t)sum;
+    uint8_t out = sign_zero_parity(result);
+    if(sum > 0xFF) {
+        out |= CARRY_FLAG;
+    }
+    if((a & 0x0F) + (b & 0x0F) + carry > 0x0F) {
+        out |= AUXILIARY_CARRY_FLAG;
+    }
+    return (alu_result_t) { result, merge_flags(flags, ALL_FLAGS, out), b, 7 };
+}
+
+// The 8080 subtracts by adding the complement, auxiliary carry is the carry
+// out of bit 3 of that addition while carry is the borrow
+static alu_result_t reference_subtract(const uint8_t a, const uint8_t b,
+                                       const uint8_t flags,
+                                       const uint8_t borrow)
+{
+    const uint8_t result = (uint8_t)(a - b - borrow);
+    uint8_t out = sign_zero_parity(result);
+    if(a < b + borrow) {
+        out |= CARRY_FLAG;
+    }
+    if((a & 0x0F) + (~b & 0x0F) + (1 - borrow) > 0x0F) {
+        out |= AUXILIARY_CARRY_FLAG;
+    }
+    return (alu_result_t) { result, merge_flags(flags, ALL_FLAGS, out), b, 7 };
+}
+
+static alu_result_t reference_compare(const uint8_t a, const uint8_t b,
+                                      const uint8_t flags)
+{
+    alu_result_t result = reference_subtract(a, b, flags, 0);
+    result.A = a;
+    return result;
+}
+
+static alu_result_t reference_and(const uint8_t a, const uint8_t b,
+                                  const uint8_t flags)
+{
+    const uint8_t result = a & b;
+    uint8_t out = sign_zero_parity(result);
+    if((a | b) & 0x08) {
+        out |= AUXILIARY_CARRY_FLAG;
+    }
+    return (alu_result_t) { result, merge_flags(flags, ALL_FLAGS, out), b, 7 };
+}
+
+static alu_result_t reference_xor(const uint8_t a, const uint8_t b,
+                                  const uint8_t flags)
+{
+    const uint8_t result = a ^ b;
+    return (alu_result_t) {
+        result, merge_flags(flags, ALL_FLAGS, sign_zero_parity(result)), b, 7
+    };
+}
+
+static alu_result_t reference_or(const uint8_t a, const uint8_t b,
+                                 const uint8_t flags)
+{
+    const uint8_t result = a | b;
+    return (alu_result_t) {
+        result, merge_flags(flags, ALL_FLAGS, sign_zero_parity(result)), b, 7
+    };
+}
+
+static alu_result_t reference_increment(const uint8_t a, const uint8_t b,
+                                        const uint8_t flags)
+{
+    const uint8_t result = b + 1;
+    uint8_t out = sign_zero_parity(result);
+    if((result & 0x0F) == 0) {
+        out |= AUXILIARY_CARRY_FLAG;
+    }
+    return (alu_result_t) {
+        a, merge_flags(flags, ALL_FLAGS & ~CARRY_FLAG, out), result, 10
+    };
+}
+
+static alu_result_t reference_decrement(const uint8_t a, const uint8_t b,
+                                        const uint8_t flags)
+{
+    const uint8_t result = b - 1;
+    uint8_t out = sign_zero_parity(result);
+    if((result & 0x0F) != 0x0F) {
+        out |= AUXILIARY_CARRY_FLAG;
+    }
+    return (alu_result_t) {
+        a, merge_flags(flags, ALL_FLAGS & ~CARRY_FLAG, out), result, 10
+    };
+}
+
+static alu_result_t reference_decimal_adjust(const uint8_t a, const uint8_t b,
+                                             const uint8_t flags)
+{
+    uint8_t correction = 0;
+    bool carry = HAS_FLAG_SET(flags, CARRY_FLAG);
+    if((a & 0x0F) > 9 || HAS_FLAG_SET(flags, AUXILIARY_CARRY_FLAG)) {
+        correction |= 0x06;
+    }
+    if((a >> 4) > 9 || carry || ((a >> 4) >= 9 && (a & 0x0F) > 9)) {
+        correction |= 0x60;
+        carry = true;
+    }
+
+    const uint8_t result = a + correction;
+    uint8_t out = sign_zero_parity(result);
+    if(carry) {
+        out |= CARRY_FLAG;
+    }
+    if((a & 0x0F) + (correction & 0x0F) > 0x0F) {
+        out |= AUXILIARY_CARRY_FLAG;
+    }
+    return (alu_result_t) { result, merge_flags(flags, ALL_FLAGS, out), b, 4 };
+}
+
+static alu_result_t reference_rotate(const uint8_t result, const bool carry,
+                                     const uint8_t b, const uint8_t flags)
+{
+    return (alu_result_t) {
+        result, merge_flags(flags, CARRY_FLAG, carry ? CARRY_FLAG : 0), b, 4
+    };
+}
+
+static alu_result_t reference_rlc(const uint8_t a, const uint8_t b,
+                                  const uint8_t flags)
+{
+    return reference_rotate((uint8_t)((a << 1) | (a >> 7)), a & 0x80, b,
+                            flags);
+}
+
+static alu_result_t reference_rrc(const uint8_t a, const uint8_t b,
+                                  const uint8_t flags)
+{
+    return reference_rotate((uint8_t)((a >> 1) | (a << 7)), a & 0x01, b,
+                            flags);
+}
+
+static alu_result_t reference_ral(const uint8_t a, const uint8_t b,
+                                  const uint8_t flags)
+{
+    return reference_rotate((uint8_t)((a << 1) | GET_FLAG(flags, CARRY_FLAG)),
+                            a & 0x80, b, flags);
+}
+
+static alu_result_t reference_rar(const uint8_t a, const uint8_t b,
+                                  const uint8_t flags)
+{
+    return reference_rotate(
+        (uint8_t)((a >> 1) | (GET_FLAG(flags, CARRY_FLAG) << 7)), a & 0x01, b,
+        flags);
+}
+
+// Runs `call` for every accumulator, operand and input flag combination and
+// compares A, the flags, the byte at (HL) and the cycles with `reference`.
+// The operand is both the immediate (`imm`) and the byte at (HL).
+#define EXERCISE_ALU(group, machine, call, reference)                          \
+    do {                                                                       \
+        uint8_t* registers = (machine)->registers;                             \
+        uint8_t* memory = (machine)->memory;                                   \
+        uint8_t* flags = &(machine)->flags;                                    \
+        for(int a = 0; a < 256; a++) {                                         \
+            for(int b = 0; b < 256; b++) {                                     \
+                const uint16_t HL = hl_addresses[(a + b) % HL_ADDRESS_COUNT];  \
+                for(size_t f = 0; f < sizeof(input_flags); f++) {              \
+                    const uint8_t imm = (uint8_t)b;                            \
+                    (void)imm;                                                 \
+                    registers[REG_A] = (uint8_t)a;                             \
+                    registers[REG_H] = HL >> 8;                                \
+                    registers[REG_L] = HL & 0xFF;                              \
+                    memory[HL] = (uint8_t)b;                                   \
+                    *flags = input_flags[f];                                   \
+                    const uint8_t cycles = (call);                             \
+                    const alu_result_t expected                                \
+                        = reference((uint8_t)a, (uint8_t)b, input_flags[f]);   \
+                    const bool passed = registers[REG_A] == expected.A         \
+                                        && *flags == expected.flags            \
+                                        && memory[HL] == expected.memory       \
+                                        && cycles == expected.cycles;          \
+                    char got[64];                                              \
+                    char want[64];                                             \
+                    snprintf(got, sizeof(got),                                 \
+                             "HL=%04x A=%02x F=%02x M=%02x %d", HL,            \
+                             registers[REG_A], *flags, memory[HL], cycles);    \
+                    snprintf(want, sizeof(want),                               \
+                             "HL=%04x A=%02x F=%02x M=%02x %d", HL,            \
+                             expected.A, expected.flags, expected.memory,      \
+                             expected.cycles);                                 \
+                    check((group), passed, #call, a, b, input_flags[f], got,   \
+                          want);                                               \
+                }                                                              \
+            }                                                                  \
+        }                                                                      \
+    } while(0)
+
+// Only a few of the wrappers need the carry in, the rest ignore it
+static alu_result_t reference_add_plain(uint8_t a, uint8_t b, uint8_t flags)
+{
+    return reference_add(a, b, flags, 0);
+}
+
+static alu_result_t reference_add_carry(uint8_t a, uint8_t b, uint8_t flags)
+{
+    return reference_add(a, b, flags, GET_FLAG(flags, CARRY_FLAG));
+}
+
+static alu_result_t reference_subtract_plain(uint8_t a, uint8_t b,
+                                             uint8_t flags)
+{
+    return reference_subtract(a, b, flags, 0);
+}
+
+static alu_result_t reference_subtract_borrow(uint8_t a, uint8_t b,
+                                              uint8_t flags)
+{
+    return reference_subtract(a, b, flags, GET_FLAG(flags, CARRY_FLAG));
+}
+
+static alu_result_t reference_cma(uint8_t a, uint8_t b, uint8_t flags)
+{
+    return (alu_result_t) { (uint8_t)~a, flags, b, 4 };
+}
+
+static alu_result_t reference_cmc(uint8_t a, uint8_t b, uint8_t flags)
+{
+    return (alu_result_t) { a, flags ^ CARRY_FLAG, b, 4 };
+}
+
+static alu_result_t reference_stc(uint8_t a, uint8_t b, uint8_t flags)
+{
+    return (alu_result_t) { a, flags | CARRY_FLAG, b, 4 };
+}
+
+static void group_add(group_t* group, machine_t* machine)
+{
+    EXERCISE_ALU(group, machine, ADD_mem(registers, memory, flags),
+                 reference_add_plain);
+    EXERCISE_ALU(group, machine, ADI(registers, imm, flags),
+                 reference_add_plain);
+    EXERCISE_ALU(group, machine, ADC_mem(registers, memory, flags),
+                 reference_add_carry);
+    EXERCISE_ALU(group, machine, ACI(registers, imm, flags),
+                 reference_add_carry);
+}
+
+static void group_subtract(group_t* group, machine_t* machine)
+{
+    EXERCISE_ALU(group, machine, SUB_mem(registers, memory, flags),
+                 reference_subtract_plain);
+    EXERCISE_ALU(group, machine, SUI(registers, imm, flags),
+                 reference_subtract_plain);
+    EXERCISE_ALU(group, machine, SBB_mem(registers, memory, flags),
+                 reference_subtract_borrow);
+    EXERCISE_ALU(group, machine, SBI(registers, imm, flags),
+                 reference_subtract_borrow);
+}
+
+static void group_logic(group_t* group, machine_t* machine)
+{
+    EXERCISE_ALU(group, machine, ANA_mem(registers, memory, flags),
+                 reference_and);
+    EXERCISE_ALU(group, machine, ANI(registers, imm, flags), reference_and);
+    EXERCISE_ALU(group, machine, XRA_mem(registers, memory, flags),
+                 reference_xor);
+    EXERCISE_ALU(group, machine, XRI(registers, imm, flags), reference_xor);
+    EXERCISE_ALU(group, machine, ORA_mem(registers, memory, flags),
+                 reference_or);
+    EXERCISE_ALU(group, machine, ORI(registers, imm, flags), reference_or);
+}
+
+static void group_compare(group_t* group, machine_t* machine)
+{
+    EXERCISE_ALU(group, machine, CMP_mem(registers, memory, flags),
+                 reference_compare);
+    EXERCISE_ALU(group, machine, CPI(registers, imm, flags),
+                 reference_compare);
+}
+
+static void group_increment(group_t* group, machine_t* machine)
+{
+    EXERCISE_ALU(group, machine, INR_mem(registers, memory, flags),
+                 reference_increment);
+    EXERCISE_ALU(group, machine, DCR_mem(registers, memory, flags),
+                 reference_decrement);
+}
+
+static void group_decimal_adjust(group_t* group, machine_t* machine)
+{
+    EXERCISE_ALU(group, machine, DDA(registers, flags),
+                 reference_decimal_adjust);
+}
+
+static void group_rotate(group_t* group, machine_t* machine)
+{
+    EXERCISE_ALU(group, machine, RLC(registers, flags), reference_rlc);
+    EXERCISE_ALU(group, machine, RRC(registers, flags), reference_rrc);
+    EXERCISE_ALU(group, machine, RAL(registers, flags), reference_ral);
+    EXERCISE_ALU(group, machine, RAR(registers, flags), reference_rar);
+}
+
+static void group_complement(group_t* group, machine_t* machine)
+{
+    EXERCISE_ALU(group, machine, CMA(registers), reference_cma);
+    EXERCISE_ALU(group, machine, CMC(flags), reference_cmc);
+    EXERCISE_ALU(group, machine, STC(flags), reference_stc);
+}
+
+// Data transfer instructions: every register holds a value derived from the
+// two operands, and `address` holds a ^ b followed by a + b. The reference
+// applies the instruction to copies of the registers and the two bytes.
+typedef struct transfer_t {
+    uint8_t registers[8];
+    uint8_t low;
+    uint8_t high;
+    uint8_t cycles;
+} transfer_t;
+
+static void transfer_lda(transfer_t* t)
+{
+    t->registers[REG_A] = t->low;
+    t->cycles = 13;
+}
+
+static void transfer_sta(transfer_t* t)
+{
+    t->low = t->registers[REG_A];
+    t->cycles = 13;
+}
+
+static void transfer_lhld(transfer_t* t)
+{
+    t->registers[REG_L] = t->low;
+    t->registers[REG_H] = t->high;
+    t->cycles = 16;
+}
+
+static void transfer_shld(transfer_t* t)
+{
+    t->low = t->registers[REG_L];
+    t->high = t->registers[REG_H];
+    t->cycles = 16;
+}
+
+static void transfer_xchg(transfer_t* t)
+{
+    uint8_t aux = t->registers[REG_H];
+    t->registers[REG_H] = t->registers[REG_D];
+    t->registers[REG_D] = aux;
+    aux = t->registers[REG_L];
+    t->registers[REG_L] = t->registers[REG_E];
+    t->registers[REG_E] = aux;
+    t->cycles = 4;
+}
+
+#define EXERCISE_TRANSFER(group, machine, address_expr, call, reference)       \
+    do {                                                                       \
+        uint8_t* registers = (machine)->registers;                             \
+        uint8_t* memory = (machine)->memory;                                   \
+        for(int a = 0; a < 256; a++) {                                         \
+            for(int b = 0; b < 256; b++) {                                     \
+                transfer_t expected;                                           \
+                for(int i = 0; i < 8; i++) {                                   \
+                    registers[i] = (uint8_t)(a * 7 + b + i * 31);              \
+                    expected.registers[i] = registers[i];                      \
+                }                                                              \
+                const uint16_t address = (address_expr);                       \
+                const uint16_t next = (uint16_t)(address + 1);                 \
+                memory[address] = expected.low = (uint8_t)(a ^ b);             \
+                memory[next] = expected.high = (uint8_t)(a + b);               \
+                const uint8_t cycles = (call);                                 \
+                reference(&expected);                                          \
+                bool passed = memcmp(registers, expected.registers, 8) == 0    \
+                              && memory[address] == expected.low               \
+                              && memory[next] == expected.high                 \
+                              && cycles == expected.cycles;                    \
+                char got[48];                                                  \
+                char want[48];                                                 \
+                snprintf(got, sizeof(got), "HL=%02x%02x M=%02x%02x %d",        \
+                         registers[REG_H], registers[REG_L], memory[next],     \
+                         memory[address], cycles);                             \
+                snprintf(want, sizeof(want), "HL=%02x%02x M=%02x%02x %d",      \
+                         expected.registers[REG_H], expected.registers[REG_L], \
+                         expected.high, expected.low, expected.cycles);        \
+                check((group), passed, #call, a, b, 0, got, want);             \
+            }                                                                  \
+        }                                                                      \
+    } while(0)
+
+static void transfer_mvi(transfer_t* t)
+{
+    t->low = t->registers[REG_B];
+    t->cycles = 10;
+}
+
+static void group_transfer(group_t* group, machine_t* machine)
+{
+    EXERCISE_TRANSFER(group, machine,
+                      ADDRESS(registers[REG_H], registers[REG_L]),
+                      MVI_mem(registers, memory, registers[REG_B]),
+                      transfer_mvi);
+    EXERCISE_TRANSFER(group, machine, ADDRESS(a, b),
+                      LDA(registers, memory, address), transfer_lda);
+    EXERCISE_TRANSFER(group, machine, ADDRESS(a, b),
+                      STA(registers, memory, address), transfer_sta);
+    EXERCISE_TRANSFER(group, machine, ADDRESS(a, b),
+                      LHLD(registers, memory, address), transfer_lhld);
+    EXERCISE_TRANSFER(group, machine, ADDRESS(a, b),
+                      SHLD(registers, memory, address), transfer_shld);
+    EXERCISE_TRANSFER(group, machine, 0, XCHG(registers), transfer_xchg);
+}
+
+static void group_jump(group_t* group, machine_t* machine)
+{
+    for(int a = 0; a < 256; a++) {
+        for(int b = 0; b < 256; b++) {
+            machine->PC = 0;
+            const uint8_t cycles = JMP((uint8_t)b, (uint8_t)a, &machine->PC);
+            char got[16];
+            char want[16];
+            snprintf(got, sizeof(got), "%04x %d", machine->PC, cycles);
+            snprintf(want, sizeof(want), "%04x %d", ADDRESS(a, b), 10);
+            check(group, machine->PC == ADDRESS(a, b) && cycles == 10, "JMP",
+                  a, b, 0, got, want);
+        }
+    }
+}
+
+// Dispatch: runs encoded instructions through cpu_step() and cpu_run() on
+// every core variant and compares the resulting state with the handler run
+// directly. The core is a single global CPU, so this is one group.
+
+#define DISPATCH_WINDOW 0x0202
+#define DISPATCH_DATA 0x0100
+#define NEXT_OPCODE 0x37 // STC
+
+typedef struct opcode_t {
+    const char* name;
+    uint8_t opcode;
+    uint8_t length;
+    uint8_t (*execute)(machine_t* machine, uint8_t low, uint8_t high);
+} opcode_t;
+
+#define OPCODE(name, call)                                                     \
+    static uint8_t execute_##name(machine_t* machine, const uint8_t low,       \
+                                  const uint8_t high)                          \
+    {                                                                          \
+        uint8_t* registers = machine->registers;                               \
+        uint8_t* memory = machine->memory;                                     \
+        uint8_t* flags = &machine->flags;                                      \
+        uint16_t* PC = &machine->PC;                                           \
+        (void)registers;                                                       \
+        (void)memory;                                                          \
+        (void)flags;                                                           \
+        (void)PC;                                                              \
+        (void)low;                                                             \
+        (void)high;                                                            \
+        return (call);                                                         \
+    }
+
+OPCODE(MVI_mem, MVI_mem(registers, memory, low))
+OPCODE(LDA, LDA(registers, memory, ADDRESS(high, low)))
+OPCODE(STA, STA(registers, memory, ADDRESS(high, low)))
+OPCODE(LHLD, LHLD(registers, memory, ADDRESS(high, low)))
+OPCODE(SHLD, SHLD(registers, memory, ADDRESS(high, low)))
+OPCODE(XCHG, XCHG(registers))
+OPCODE(ADD_mem, ADD_mem(registers, memory, flags))
+OPCODE(ADI, ADI(registers, low, flags))
+OPCODE(ADC_mem, ADC_mem(registers, memory, flags))
+OPCODE(ACI, ACI(registers, low, flags))
+OPCODE(SUB_mem, SUB_mem(registers, memory, flags))
+OPCODE(SUI, SUI(registers, low, flags))
+OPCODE(SBB_mem, SBB_mem(registers, memory, flags))
+OPCODE(SBI, SBI(registers, low, flags))
+OPCODE(INR_mem, INR_mem(registers, memory, flags))
+OPCODE(DCR_mem, DCR_mem(registers, memory, flags))
+OPCODE(DDA, DDA(registers, flags))
+OPCODE(ANA_mem, ANA_mem(registers, memory, flags))
+OPCODE(ANI, ANI(registers, low, flags))
+OPCODE(XRA_mem, XRA_mem(registers, memory, flags))
+OPCODE(XRI, XRI(registers, low, flags))
+OPCODE(ORA_mem, ORA_mem(registers, memory, flags))
+OPCODE(ORI, ORI(registers, low, flags))
+OPCODE(CMP_mem, CMP_mem(registers, memory, flags))
+OPCODE(CPI, CPI(registers, low, flags))
+OPCODE(RLC, RLC(registers, flags))
+OPCODE(RRC, RRC(registers, flags))
+OPCODE(RAL, RAL(registers, flags))
+OPCODE(RAR, RAR(registers, flags))
+OPCODE(CMA, CMA(registers))
+OPCODE(CMC, CMC(flags))
+OPCODE(STC, STC(flags))
+OPCODE(JMP, JMP(low, high, PC))
+
+static const opcode_t opcodes[] = {
+    { "MVI M", 0x36, 2, execute_MVI_mem },
+    { "LDA", 0x3A, 3, execute_LDA },
+    { "STA", 0x32, 3, execute_STA },
+    { "LHLD", 0x2A, 3, execute_LHLD },
+    { "SHLD", 0x22, 3, execute_SHLD },
+    { "XCHG", 0xEB, 1, execute_XCHG },
+    { "ADD M", 0x86, 1, execute_ADD_mem },
+    { "ADI", 0xC6, 2, execute_ADI },
+    { "ADC M", 0x8E, 1, execute_ADC_mem },
+    { "ACI", 0xCE, 2, execute_ACI },
+    { "SUB M", 0x96, 1, execute_SUB_mem },
+    { "SUI", 0xD6, 2, execute_SUI },
+    { "SBB M", 0x9E, 1, execute_SBB_mem },
+    { "SBI", 0xDE, 2, execute_SBI },
+    { "INR M", 0x34, 1, execute_INR_mem },
+    { "DCR M", 0x35, 1, execute_DCR_mem },
+    { "DAA", 0x27, 1, execute_DDA },
+    { "ANA M", 0xA6, 1, execute_ANA_mem },
+    { "ANI", 0xE6, 2, execute_ANI },
+    { "XRA M", 0xAE, 1, execute_XRA_mem },
+    { "XRI", 0xEE, 2, execute_XRI },
+    { "ORA M", 0xB6, 1, execute_ORA_mem },
+    { "ORI", 0xF6, 2, execute_ORI },
+    { "CMP M", 0xBE, 1, execute_CMP_mem },
+    { "CPI", 0xFE, 2, execute_CPI },
+    { "RLC", 0x07, 1, execute_RLC },
+    { "RRC", 0x0F, 1, execute_RRC },
+    { "RAL", 0x17, 1, execute_RAL },
+    { "RAR", 0x1F, 1, execute_RAR },
+    { "CMA", 0x2F, 1, execute_CMA },
+    { "CMC", 0x3F, 1, execute_CMC },
+    { "STC", 0x37, 1, execute_STC },
+    { "JMP", 0xC3, 3, execute_JMP },
+};
+
+static const uint8_t variants[] = { CPU_VARIANT_FAST, CPU_VARIANT_CYCLES,
+                                    CPU_VARIANT_HOOKS, CPU_VARIANT_ACCURATE };
+
+// The accumulator only needs a spread of values here, the ALU groups cover
+// all of them
+static const uint8_t dispatch_accumulators[]
+    = { 0x00, 0x01, 0x0F, 0x10, 0x3C, 0x5A, 0x7F, 0x80,
+        0x99, 0x9A, 0xA5, 0xC3, 0xE7, 0xF0, 0xFE, 0xFF };
+
+extern uint8_t memory[];
+
+static void dispatch_case(group_t* group, machine_t* machine,
+                          const uint8_t variant, const opcode_t* op,
+                          const uint8_t a, const uint8_t b,
+                          const uint8_t flags_in)
+{
+    // JMP targets the next opcode so that it stays inside the window
+    const uint8_t low = op->opcode == 0xC3 ? op->length : b;
+    const uint8_t high = op->length == 3 && op->opcode != 0xC3
+                             ? DISPATCH_DATA >> 8
+                             : 0;
+
+    const uint16_t HL = hl_addresses[(a + b) % HL_ADDRESS_COUNT];
+
+    memset(memory, 0, DISPATCH_WINDOW);
+    memory[0] = op->opcode;
+    memory[1] = low;
+    memory[2] = high;
+    memory[op->length] = NEXT_OPCODE;
+    memory[HL] = b ^ 0x5A;
+    if(high != 0) {
+        memory[ADDRESS(high, low)] = a ^ b;
+        memory[ADDRESS(high, low) + 1] = a + b;
+    }
+
+    cpu_state_t state = { 0 };
+    for(int i = 0; i < 8; i++) {
+        state.registers[i] = (uint8_t)(a * 7 + b + i * 31);
+    }
+    state.registers[REG_A] = a;
+    state.registers[REG_H] = HL >> 8;
+    state.registers[REG_L] = HL & 0xFF;
+    state.flags = flags_in;
+
+    // Expected: the handler on a copy of the window and the byte at HL
+    memcpy(machine->memory, memory, DISPATCH_WINDOW);
+    machine->memory[HL] = memory[HL];
+    memcpy(machine->registers, state.registers, 8);
+    machine->flags = flags_in;
+    machine->PC = 0;
+    const uint8_t cycles = op->execute(machine, low, high);
+    const uint16_t expected_PC = op->opcode == 0xC3 ? machine->PC
+                                                    : op->length;
+
+    cpu_init();
+    cpu_set_variant(variant);
+    cpu_set_state(&state);
+    cpu_step();
+
+    bool passed = cpu_instruction_count() == 1;
+    if(variant & CPU_VARIANT_CYCLES) {
+        passed = passed && cpu_cycle_count() == cycles;
+        // The rest of the instruction must not start anything new
+        if(b % 2 == 0) {
+            for(int i = 1; i < cycles; i++) {
+                cpu_step();
+            }
+        } else {
+            cpu_run(cycles - 1);
+        }
+        passed = passed && cpu_instruction_count() == 1;
+    }
+
+    cpu_get_state(&state);
+    passed = passed && memcmp(state.registers, machine->registers, 8) == 0
+             && state.flags == machine->flags && state.PC == expected_PC
+             && memcmp(memory, machine->memory, DISPATCH_WINDOW) == 0
+             && memory[HL] == machine->memory[HL];
+
+    // The next step starts the following instruction
+    cpu_step();
+    passed = passed && cpu_instruction_count() == 2;
+
+    char name[32];
+    char got[48];
+    char want[48];
+    snprintf(name, sizeof(name), "%s (variant %d)", op->name, variant);
+    snprintf(got, sizeof(got), "HL=%04x A=%02x F=%02x M=%02x PC=%04x", HL,
+             state.registers[REG_A], state.flags, memory[HL], state.PC);
+    snprintf(want, sizeof(want), "HL=%04x A=%02x F=%02x M=%02x PC=%04x", HL,
+             machine->registers[REG_A], machine->flags, machine->memory[HL],
+             expected_PC);
+    check(group, passed, name, a, b, flags_in, got, want);
+}
+
+static void group_dispatch(group_t* group, machine_t* machine)
+{
+    for(size_t v = 0; v < sizeof(variants); v++) {
+        for(size_t o = 0; o < sizeof(opcodes) / sizeof(opcodes[0]); o++) {
+            for(size_t a = 0; a < sizeof(dispatch_accumulators); a++) {
+                for(int b = 0; b < 256; b++) {
+                    for(size_t f = 0; f < sizeof(input_flags); f++) {
+                        dispatch_case(group, machine, variants[v], &opcodes[o],
+                                      dispatch_accumulators[a], (uint8_t)b,
+                                      input_flags[f]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// BDOS: drives the host side CP/M calls through cpu_step() at 0005h, in a
+// scratch directory since it creates and deletes files
+
+#define BDOS_FCB 0x005C
+#define BDOS_STACK 0x0200
+#define BDOS_RETURN 0x1234
+#define CPM_RECORD_SIZE 128
+
+// CP/M 2.2 FCB layout
+#define FCB_EXTENT 12
+#define FCB_CURRENT_RECORD 32
+#define FCB_RANDOM_RECORD 33
+#define FCB_SIZE 36
+
+static void expect(group_t* group, const char* name, const long got,
+                   const long expected)
+{
+    char got_text[24];
+    char expected_text[24];
+    snprintf(got_text, sizeof(got_text), "%ld", got);
+    snprintf(expected_text, sizeof(expected_text), "%ld", expected);
+    check(group, got == expected, name, 0, 0, 0, got_text, expected_text);
+}
+
+// Calls BDOS function `function` with DE = `DE` the way a guest would reach
+// it, with the return address on the stack, and checks that it returned
+static uint8_t bdos(group_t* group, const char* name, const uint8_t function,
+                    const uint16_t DE)
+{
+    cpu_state_t state = { 0 };
+    state.registers[REG_C] = function;
+    state.registers[REG_D] = DE >> 8;
+    state.registers[REG_E] = DE & 0xFF;
+    state.SP = BDOS_STACK;
+    state.PC = BDOS_ENTRY;
+    memory[BDOS_STACK] = BDOS_RETURN & 0xFF;
+    memory[BDOS_STACK + 1] = BDOS_RETURN >> 8;
+    cpu_set_state(&state);
+    const uint64_t cycles = cpu_cycle_count();
+    cpu_step();
+    // Cycle variants account for the RET, finish it before the next call
+    const uint64_t busy = cpu_cycle_count() - cycles;
+    if(busy > 1) {
+        cpu_run(busy - 1);
+    }
+
+    cpu_get_state(&state);
+    const bool returned = !cpu_halted() && state.PC == BDOS_RETURN
+                          && state.SP == BDOS_STACK + 2
+                          && state.registers[REG_L] == state.registers[REG_A]
+                          && state.registers[REG_B] == 0
+                          && state.registers[REG_H] == 0;
+    check(group, returned, name, function, 0, 0, returned ? "returned" : "lost",
+          "returned");
+    return state.registers[REG_A];
+}
+
+static void set_fcb(const char* name)
+{
+    memset(&memory[BDOS_FCB], 0, FCB_SIZE);
+    memcpy(&memory[BDOS_FCB + 1], name, 11);
+}
+
+static void fill_record(const uint16_t address, const uint8_t seed)
+{
+    for(int i = 0; i < CPM_RECORD_SIZE; i++) {
+        memory[address + i] = (uint8_t)(seed + i);
+    }
+}
+
+static bool record_matches(const uint16_t address, const uint8_t seed)
+{
+    for(int i = 0; i < CPM_RECORD_SIZE; i++) {
+        if(memory[address + i] != (uint8_t)(seed + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void bdos_files(group_t* group)
+{
+    set_fcb("TEST    DAT");
+    bdos(group, "delete stale", BDOS_DELETE_FILE, BDOS_FCB);
+    expect(group, "make", bdos(group, "make", BDOS_MAKE_FILE, BDOS_FCB), 0);
+    for(int r = 0; r < 3; r++) {
+        fill_record(BDOS_DEFAULT_DMA, (uint8_t)(r * 16));
+        expect(group, "write sequential",
+               bdos(group, "write sequential", BDOS_WRITE_SEQUENTIAL,
+                    BDOS_FCB),
+               0);
+    }
+    expect(group, "record after writes",
+           memory[BDOS_FCB + FCB_CURRENT_RECORD], 3);
+    expect(group, "close", bdos(group, "close", BDOS_CLOSE_FILE, BDOS_FCB),
+           0);
+
+    memory[BDOS_FCB + FCB_CURRENT_RECORD] = 7;
+    expect(group, "open", bdos(group, "open", BDOS_OPEN_FILE, BDOS_FCB), 0);
+    expect(group, "record after open", memory[BDOS_FCB + FCB_CURRENT_RECORD],
+           0);
+    for(int r = 0; r < 3; r++) {
+        memset(&memory[BDOS_DEFAULT_DMA], 0, CPM_RECORD_SIZE);
+        expect(group, "read sequential",
+               bdos(group, "read sequential", BDOS_READ_SEQUENTIAL, BDOS_FCB),
+               0);
+        expect(group, "read sequential data",
+               record_matches(BDOS_DEFAULT_DMA, (uint8_t)(r * 16)), true);
+    }
+    expect(group, "read sequential at end",
+           bdos(group, "read at end", BDOS_READ_SEQUENTIAL, BDOS_FCB), 1);
+
+    expect(group, "compute file size",
+           bdos(group, "compute file size", BDOS_COMPUTE_FILE_SIZE, BDOS_FCB),
+           0);
+    expect(group, "file size", memory[BDOS_FCB + FCB_RANDOM_RECORD], 3);
+    expect(group, "file size high", memory[BDOS_FCB + FCB_RANDOM_RECORD + 1],
+           0);
+
+    // Random access leaves the sequential position at the accessed record
+    memory[BDOS_FCB + FCB_RANDOM_RECORD] = 1;
+    fill_record(BDOS_DEFAULT_DMA, 0xA0);
+    expect(group, "write random",
+           bdos(group, "write random", BDOS_WRITE_RANDOM, BDOS_FCB), 0);
+    expect(group, "record after write random",
+           memory[BDOS_FCB + FCB_CURRENT_RECORD], 1);
+    memset(&memory[BDOS_DEFAULT_DMA], 0, CPM_RECORD_SIZE);
+    expect(group, "read after write random",
+           bdos(group, "read after random", BDOS_READ_SEQUENTIAL, BDOS_FCB),
+           0);
+    expect(group, "read after write random data",
+           record_matches(BDOS_DEFAULT_DMA, 0xA0), true);
+
+    memory[BDOS_FCB + FCB_RANDOM_RECORD] = 0;
+    expect(group, "read random",
+           bdos(group, "read random", BDOS_READ_RANDOM, BDOS_FCB), 0);
+    expect(group, "read random data", record_matches(BDOS_DEFAULT_DMA, 0),
+           true);
+    expect(group, "record after read random",
+           memory[BDOS_FCB + FCB_CURRENT_RECORD], 0);
+    expect(group, "extent after read random", memory[BDOS_FCB + FCB_EXTENT],
+           0);
+
+    memory[BDOS_FCB + FCB_RANDOM_RECORD] = 10;
+    expect(group, "read random past end",
+           bdos(group, "read random past end", BDOS_READ_RANDOM, BDOS_FCB), 1);
+    memory[BDOS_FCB + FCB_RANDOM_RECORD + 2] = 1;
+    expect(group, "read random out of range",
+           bdos(group, "read random out of range", BDOS_READ_RANDOM,
+                BDOS_FCB),
+           6);
+
+    memory[BDOS_FCB + FCB_CURRENT_RECORD] = 2;
+    bdos(group, "set random record", BDOS_SET_RANDOM_RECORD, BDOS_FCB);
+    expect(group, "set random record", memory[BDOS_FCB + FCB_RANDOM_RECORD],
+           2);
+    expect(group, "set random record high",
+           memory[BDOS_FCB + FCB_RANDOM_RECORD + 2], 0);
+
+    // A DMA buffer past the end of memory is refused, not overrun
+    bdos(group, "set dma", BDOS_SET_DMA, MAX_MEMORY_SIZE - 64);
+    expect(group, "read into dma out of range",
+           bdos(group, "read dma out of range", BDOS_READ_SEQUENTIAL,
+                BDOS_FCB),
+           0xFF);
+    expect(group, "write from dma out of range",
+           bdos(group, "write dma out of range", BDOS_WRITE_SEQUENTIAL,
+                BDOS_FCB),
+           0xFF);
+    bdos(group, "set dma", BDOS_SET_DMA, BDOS_DEFAULT_DMA);
+
+    expect(group, "close", bdos(group, "close", BDOS_CLOSE_FILE, BDOS_FCB),
+           0);
+    expect(group, "delete", bdos(group, "delete", BDOS_DELETE_FILE, BDOS_FCB),
+           0);
+    expect(group, "open deleted",
+           bdos(group, "open deleted", BDOS_OPEN_FILE, BDOS_FCB), 0xFF);
+}
+
+static void bdos_names(group_t* group)
+{
+    // Anything that could leave the working directory, and text after the
+    // padding, is refused before touching the host
+    static const char* invalid[] = {
+        "../ETC     ", "..      DAT", "A/B     DAT", "AB  CD  DAT",
+        "TEST    D A", "        DAT", "TEST*   DAT", "A\\B     DAT",
+    };
+    for(size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        set_fcb(invalid[i]);
+        expect(group, invalid[i],
+               bdos(group, "make invalid", BDOS_MAKE_FILE, BDOS_FCB), 0xFF);
+        expect(group, invalid[i],
+               bdos(group, "open invalid", BDOS_OPEN_FILE, BDOS_FCB), 0xFF);
+    }
+    expect(group, "no file created", access("../etc", F_OK) == 0
+                                         || access("a", F_OK) == 0,
+           false);
+
+    // An FCB running past the end of memory is refused
+    expect(group, "open fcb out of range",
+           bdos(group, "open fcb out of range", BDOS_OPEN_FILE,
+                MAX_MEMORY_SIZE - FCB_SIZE + 1),
+           0xFF);
+    expect(group, "make fcb out of range",
+           bdos(group, "make fcb out of range", BDOS_MAKE_FILE, 0xFFF0), 0xFF);
+    expect(group, "read fcb out of range",
+           bdos(group, "read fcb out of range", BDOS_READ_SEQUENTIAL, 0xFFF0),
+           0xFF);
+    expect(group, "version", bdos(group, "version", BDOS_VERSION, 0), 0x22);
+}
+
+static void bdos_termination(group_t* group)
+{
+    // A stack outside of memory can't be returned through, the guest warm
+    // boots and the host is told
+    cpu_state_t state = { 0 };
+    state.registers[REG_C] = BDOS_VERSION;
+    state.SP = MAX_MEMORY_SIZE - 1;
+    state.PC = BDOS_ENTRY;
+    cpu_set_state(&state);
+    cpu_step();
+    cpu_get_state(&state);
+    expect(group, "stack out of range halts", cpu_halted(), true);
+    expect(group, "stack out of range warm boots", state.PC, 0);
+
+    const uint64_t instructions = cpu_instruction_count();
+    cpu_step();
+    cpu_run(100);
+    expect(group, "halted guest stays halted", cpu_instruction_count(),
+           (long)instructions);
+
+    cpu_init();
+    expect(group, "cpu_init resumes", cpu_halted(), false);
+    bdos(group, "version after resume", BDOS_VERSION, 0);
+
+    state.registers[REG_C] = BDOS_SYSTEM_RESET;
+    state.SP = BDOS_STACK;
+    state.PC = BDOS_ENTRY;
+    cpu_set_state(&state);
+    cpu_run(100);
+    cpu_get_state(&state);
+    expect(group, "system reset halts", cpu_halted(), true);
+    expect(group, "system reset warm boots", state.PC, 0);
+    expect(group, "system reset stops cpu_run", cpu_instruction_count(),
+           2);
+}
+
+// Host files are created in a fresh directory under /tmp, the groups that
+// use one hold the core lock so the working directory is theirs
+typedef struct scratch_t {
+    char cwd[4096];
+    char directory[32];
+} scratch_t;
+
+static bool enter_scratch(group_t* group, scratch_t* scratch)
+{
+    snprintf(scratch->directory, sizeof(scratch->directory),
+             "/tmp/conformance-XXXXXX");
+    if(getcwd(scratch->cwd, sizeof(scratch->cwd)) == NULL
+       || mkdtemp(scratch->directory) == NULL
+       || chdir(scratch->directory) != 0) {
+        check(group, false, "scratch directory", 0, 0, 0, "none", "created");
+        return false;
+    }
+    return true;
+}
+
+static void leave_scratch(group_t* group, const scratch_t* scratch)
+{
+    if(chdir(scratch->cwd) != 0 || rmdir(scratch->directory) != 0) {
+        check(group, false, "scratch directory", 0, 0, 0, "left", "removed");
+    }
+}
+
+static void group_bdos(group_t* group, machine_t* machine)
+{
+    (void)machine;
+    scratch_t scratch;
+    if(!enter_scratch(group, &scratch)) {
+        return;
+    }
+
+    for(size_t v = 0; v < sizeof(variants); v++) {
+        cpu_init();
+        cpu_set_variant(variants[v]);
+        cpu_enable_bdos_trap(true);
+        bdos_files(group);
+        bdos_names(group);
+        bdos_termination(group);
+        cpu_enable_bdos_trap(false);
+    }
+
+    remove("test.dat");
+    leave_scratch(group, &scratch);
+}
+
+// Video: renders through both buffers and compares every pixel with a per
+// bit model of the rotation, then checks which writes mark lines dirty. The
+// group name tells which kernel this binary was built with.
+
+#if defined(__AVX2__)
+#define VIDEO_GROUP_NAME "video_avx2"
+#elif defined(__SSE2__)
+#define VIDEO_GROUP_NAME "video_sse2"
+#else
+#define VIDEO_GROUP_NAME "video_scalar"
+#endif
+
+static bool frame_matches(const uint32_t* frame)
+{
+    for(int x = 0; x < VIDEO_WIDTH; x++) {
+        for(int y = 0; y < VIDEO_HEIGHT; y++) {
+            const uint8_t byte = memory[VIDEO_RAM_START
+                                        + x * VIDEO_BYTES_PER_LINE + y / 8];
+            const uint32_t pixel = ((byte >> (y % 8)) & 1) ? VIDEO_FOREGROUND
+                                                           : VIDEO_BACKGROUND;
+            if(frame[(VIDEO_HEIGHT - 1 - y) * VIDEO_WIDTH + x] != pixel) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void expect_frame(group_t* group, const char* name)
+{
+    const uint32_t* frame = video_acquire_frame();
+    expect(group, name, frame_matches(frame), true);
+    video_release_frame();
+}
+
+static void expect_dirty(group_t* group, const char* name,
+                         const uint32_t* lines)
+{
+    for(int w = 0; w < VIDEO_DIRTY_WORDS; w++) {
+        expect(group, name, video_dirty_lines[w], lines[w]);
+    }
+}
+
+static void video_renders(group_t* group)
+{
+    uint32_t seed = 0x2400;
+    for(int i = 0; i < VIDEO_RAM_SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        memory[VIDEO_RAM_START + i] = (uint8_t)(seed >> 16);
+    }
+
+    video_init();
+    expect(group, "render", video_render(memory), true);
+    expect_frame(group, "full render");
+    video_invalidate();
+    expect(group, "render", video_render(memory), true);
+    expect_frame(group, "full render, other buffer");
+
+    // Partial updates have to reach both buffers, including lines in the
+    // same group of 8 as a dirty one and the first and last lines
+    for(int round = 0; round < 64; round++) {
+        for(int i = 0; i < 5; i++) {
+            seed = seed * 1103515245 + 12345;
+            const uint16_t offset = (seed >> 8) % VIDEO_RAM_SIZE;
+            memory[VIDEO_RAM_START + offset] ^= (uint8_t)(seed >> 24) | 1;
+            video_mark_dirty(VIDEO_RAM_START + offset);
+        }
+        memory[VIDEO_RAM_START + round] ^= 0x81;
+        video_mark_dirty(VIDEO_RAM_START + round);
+        memory[VIDEO_RAM_START + VIDEO_RAM_SIZE - 1 - round] ^= 0x18;
+        video_mark_dirty(VIDEO_RAM_START + VIDEO_RAM_SIZE - 1 - round);
+
+        expect(group, "render", video_render(memory), true);
+        expect_frame(group, "partial render");
+        expect(group, "render", video_render(memory), true);
+        expect_frame(group, "partial render, other buffer");
+    }
+
+    // The back buffer stays untouched while the presenter holds it
+    const uint32_t* held = video_acquire_frame();
+    memory[VIDEO_RAM_START] ^= 0xFF;
+    video_mark_dirty(VIDEO_RAM_START);
+    expect(group, "render while a frame is held", video_render(memory), true);
+    expect(group, "render into the held frame", video_render(memory), false);
+    expect(group, "held frame keeps its content", frame_matches(held), false);
+    video_release_frame();
+    expect(group, "render after release", video_render(memory), true);
+    expect_frame(group, "render after release");
+}
+
+// STA, SHLD and MVI M into video RAM, and STA just below it
+static const uint8_t video_program[] = {
+    0x32, 0xA3, 0x24,  // STA 24A3h: line 5
+    0x22, 0x3F, 0x25,  // SHLD 253Fh: lines 9 and 10
+    0x36, 0x5A,        // MVI M, HL = 3D00h: line 200
+    0x32, 0xFF, 0x23,  // STA 23FFh: none
+    0x37,              // STC
+};
+
+static void video_writes(group_t* group)
+{
+    static const uint32_t tracked[VIDEO_DIRTY_WORDS]
+        = { (1U << 5) | (1U << 9) | (1U << 10), 0, 0, 0, 0, 0, 1U << 8 };
+    static const uint32_t untracked[VIDEO_DIRTY_WORDS] = { 0 };
+
+    for(size_t v = 0; v < sizeof(variants); v++) {
+        cpu_init();
+        cpu_set_variant(variants[v]);
+        memset(memory, 0, sizeof(video_program) + 1);
+        memcpy(memory, video_program, sizeof(video_program));
+
+        cpu_state_t state = { 0 };
+        state.registers[REG_H] = 0x3D;
+        state.registers[REG_L] = 0x00;
+        cpu_set_state(&state);
+
+        memset(video_dirty_lines, 0, sizeof(video_dirty_lines));
+        while(cpu_instruction_count() < 5) {
+            cpu_step();
+        }
+        expect_dirty(group,
+                     (variants[v] & CPU_VARIANT_HOOKS) ? "hooks mark writes"
+                                                       : "no hooks, no marks",
+                     (variants[v] & CPU_VARIANT_HOOKS) ? tracked : untracked);
+    }
+
+    // The BDOS marks what it writes, e.g. a DMA buffer in video RAM
+    cpu_init();
+    cpu_enable_bdos_trap(true);
+    set_fcb("VIDEO   DAT");
+    bdos(group, "make", BDOS_MAKE_FILE, BDOS_FCB);
+    bdos(group, "write", BDOS_WRITE_SEQUENTIAL, BDOS_FCB);
+    bdos(group, "close", BDOS_CLOSE_FILE, BDOS_FCB);
+    bdos(group, "open", BDOS_OPEN_FILE, BDOS_FCB);
+    bdos(group, "set dma", BDOS_SET_DMA, VIDEO_RAM_START + 40 * 32 + 16);
+    memset(video_dirty_lines, 0, sizeof(video_dirty_lines));
+    expect(group, "read into video RAM",
+           bdos(group, "read", BDOS_READ_SEQUENTIAL, BDOS_FCB), 0);
+    static const uint32_t dma_lines[VIDEO_DIRTY_WORDS]
+        = { 0, 0x1F << 8, 0, 0, 0, 0, 0 };
+    expect_dirty(group, "bdos marks its writes", dma_lines);
+    bdos(group, "close", BDOS_CLOSE_FILE, BDOS_FCB);
+    bdos(group, "delete", BDOS_DELETE_FILE, BDOS_FCB);
+    cpu_enable_bdos_trap(false);
+}
+
+static void expect_range(group_t* group, const char* name,
+                         const uint16_t address, const uint32_t size,
+                         const uint32_t last_word)
+{
+    static const uint32_t none[VIDEO_DIRTY_WORDS] = { 0 };
+    uint32_t lines[VIDEO_DIRTY_WORDS];
+    memcpy(lines, none, sizeof(lines));
+    lines[VIDEO_DIRTY_WORDS - 1] = last_word;
+
+    memset(video_dirty_lines, 0, sizeof(video_dirty_lines));
+    video_mark_dirty_range(address, size);
+    expect_dirty(group, name, lines);
+}
+
+static void video_ranges(group_t* group)
+{
+    // Line 223 is bit 31 of the last word
+    const uint32_t last = 1U << 31;
+    expect_range(group, "last byte", 0x3FFF, 1, last);
+    expect_range(group, "across the end", 0x3FF0, 0x40, last);
+    expect_range(group, "to the end of memory", 0x3FFF, 0xC001, last);
+    expect_range(group, "last two lines", 0x3FDF, 2, (1U << 30) | last);
+    expect_range(group, "past video RAM", 0x4000, 0x100, 0);
+    expect_range(group, "top of memory", 0xFFF0, 0x20, 0);
+    expect_range(group, "empty", 0x3FFF, 0, 0);
+
+    memset(video_dirty_lines, 0, sizeof(video_dirty_lines));
+    video_mark_dirty_range(0x23F0, 0x11);
+    expect(group, "first byte", video_dirty_lines[0], 1);
+}
+
+static void group_video(group_t* group, machine_t* machine)
+{
+    (void)machine;
+    scratch_t scratch;
+    if(!enter_scratch(group, &scratch)) {
+        return;
+    }
+
+    video_renders(group);
+    video_writes(group);
+    video_ranges(group);
+
+    leave_scratch(group, &scratch);
+}
+
+// The handlers have known bugs. Each group records how many of its cases
+// currently deviate from the reference and a fingerprint of exactly which
+// ones, so a run only fails when the results change. After fixing a handler,
+// update its entries with the values the runner prints.
+static group_t groups[] = {
+    // parity from result % 2, ADC M drops H from HL
+    { .name = "add",
+      .run = group_add,
+      .known_mismatches = 794494,
+      .known_fingerprint = 0x0CB0831CCB2FA9EEULL },
+    // parity, auxiliary carry as a borrow, SBI computes its flags as an
+    // addition, SBB M drops H
+    { .name = "subtract",
+      .run = group_subtract,
+      .known_mismatches = 1310720,
+      .known_fingerprint = 0x2BD67AD7164D78DBULL },
+    // parity, ANA auxiliary carry, memory forms drop H
+    { .name = "logic",
+      .run = group_logic,
+      .known_mismatches = 1494905,
+      .known_fingerprint = 0x23EE2E76A5C2829BULL },
+    // parity, auxiliary carry as a borrow, CMP M drops H
+    { .name = "compare",
+      .run = group_compare,
+      .known_mismatches = 640905,
+      .known_fingerprint = 0x8D06478F7E9EF61CULL },
+    // parity, INR M and DCR M drop H
+    { .name = "increment",
+      .run = group_increment,
+      .known_mismatches = 631995,
+      .known_fingerprint = 0xE64EBD5C36082A6CULL },
+    // flags of DAA
+    { .name = "decimal_adjust",
+      .run = group_decimal_adjust,
+      .known_mismatches = 173568,
+      .known_fingerprint = 0xF9D34C954F9BE3B1ULL },
+    { .name = "rotate", .run = group_rotate },
+    { .name = "complement", .run = group_complement },
+    // LHLD and SHLD don't wrap at FFFFh
+    { .name = "transfer",
+      .run = group_transfer,
+      .known_mismatches = 2,
+      .known_fingerprint = 0xA474D1C8D3B5923BULL },
+    { .name = "jump", .run = group_jump },
+    { .name = "dispatch", .run = group_dispatch, .uses_core = true },
+    { .name = "bdos", .run = group_bdos, .uses_core = true },
+    { .name = VIDEO_GROUP_NAME, .run = group_video, .uses_core = true },
+};
+
+#define GROUP_COUNT (sizeof(groups) / sizeof(groups[0]))
+
+static atomic_size_t next_group = 0;
+static pthread_mutex_t core_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void* worker(void* arg)
+{
+    (void)arg;
+    machine_t* machine = calloc(1, sizeof(machine_t));
+    if(machine == NULL) {
+        return NULL;
+    }
+
+    for(size_t i = atomic_fetch_add(&next_group, 1); i < GROUP_COUNT;
+        i = atomic_fetch_add(&next_group, 1)) {
+        // Mismatches can depend on stale memory, start every group the same
+        memset(machine, 0, sizeof(machine_t));
+        if(groups[i].uses_core) {
+            pthread_mutex_lock(&core_lock);
+        }
+        groups[i].run(&groups[i], machine);
+        if(groups[i].uses_core) {
+            pthread_mutex_unlock(&core_lock);
+        }
+    }
+
+    free(machine);
+    return NULL;
+}
+
+int main()
+{
+    long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if(thread_count < 1) {
+        thread_count = 1;
+    }
+    if(thread_count > (long)GROUP_COUNT) {
+        thread_count = GROUP_COUNT;
+    }
+
+    pthread_t threads[GROUP_COUNT];
+    for(long i = 0; i < thread_count; i++) {
+        if(pthread_create(&threads[i], NULL, worker, NULL) != 0) {
+            fprintf(stderr, "failed to start worker %ld\n", i);
+            return 1;
+        }
+    }
+    for(long i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    int failures = 0;
+    for(size_t i = 0; i < GROUP_COUNT; i++) {
+        const group_t* group = &groups[i];
+        const uint64_t fingerprint
+            = group->mismatches == 0 ? 0 : group->fingerprint;
+        const bool passed = group->cases > 0
+                            && group->mismatches == group->known_mismatches
+                            && fingerprint == group->known_fingerprint;
+        const char* status = !passed                ? "ERROR"
+                             : group->mismatches > 0 ? "KNOWN"
+                                                     : "OK";
+        printf("%-16s %10llu cases %10llu mismatches %s\n", group->name,
+               (unsigned long long)group->cases,
+               (unsigned long long)group->mismatches, status);
+        if(group->mismatches > 0) {
+            printf("    first: %s\n", group->first_mismatch);
+        }
+        if(!passed) {
+            printf("    recorded %llu mismatches (fingerprint 0x%016llX), got "
+                   "%llu (fingerprint 0x%016llX)\n",
+                   (unsigned long long)group->known_mismatches,
+                   (unsigned long long)group->known_fingerprint,
+                   (unsigned long long)group->mismatches,
+                   (unsigned long long)fingerprint);
+            failures++;
+        }
+    }
+
+    printf("%zu groups, %d failed\n", GROUP_COUNT, failures);
+    return failures == 0 ? 0 : 1;
+}
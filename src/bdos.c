@@ -0,0 +1,518 @@
+#include "include/bdos.h"
+#include "include/definitions.h"
+#include "include/video.h"
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BDOS_ERROR 0xFF
+#define CPM_RECORD_SIZE 128
+#define CPM_EOF 0x1A
+#define MAX_OPEN_FILES 16
+#define HOST_BUFFER_SIZE (64 * 1024)
+
+// FCB layout: drive, 8 byte name, 3 byte type, extent, s1, s2, record count,
+// allocation map, the current record and the 3 byte random record
+#define FCB_NAME 1
+#define FCB_TYPE 9
+#define FCB_EXTENT 12
+#define FCB_MODULE 14
+#define FCB_RECORD_COUNT 15
+#define FCB_CURRENT_RECORD 32
+#define FCB_RANDOM_RECORD 33
+#define FCB_SIZE 36
+
+#define RECORDS_PER_EXTENT 128
+#define EXTENTS_PER_MODULE 32
+
+// 8 + '.' + 3 + '\0'
+#define HOST_NAME_SIZE 13
+
+typedef enum access_t {
+    ACCESS_NONE,
+    ACCESS_READ,
+    ACCESS_WRITE
+} access_t;
+
+typedef struct open_file_t {
+    FILE* file;
+    long position;
+    access_t last_access;
+    uint16_t fcb;
+} open_file_t;
+
+static open_file_t open_files[MAX_OPEN_FILES];
+static uint16_t dma = BDOS_DEFAULT_DMA;
+static bool reported_unsupported[256];
+
+void bdos_reset()
+{
+    for(int i = 0; i < MAX_OPEN_FILES; i++) {
+        if(open_files[i].file != NULL) {
+            fclose(open_files[i].file);
+            open_files[i].file = NULL;
+        }
+    }
+    dma = BDOS_DEFAULT_DMA;
+}
+
+// Guest pointers come straight from registers, anything that runs past the
+// end of memory is rejected
+static bool fits(const uint16_t address, const uint32_t size)
+{
+    return (uint32_t)address + size <= MAX_MEMORY_SIZE;
+}
+
+static open_file_t* find_file(const uint16_t fcb)
+{
+    for(int i = 0; i < MAX_OPEN_FILES; i++) {
+        if(open_files[i].file != NULL && open_files[i].fcb == fcb) {
+            return &open_files[i];
+        }
+    }
+    return NULL;
+}
+
+// Besides what CP/M forbids in file names, anything that could leave the
+// working directory on the host is refused
+static bool valid_name_char(const char c)
+{
+    if(c <= ' ' || c >= 0x7F) {
+        return false;
+    }
+    return strchr("<>.,;:=?*[]%|()/\\", c) == NULL;
+}
+
+// Copies a space padded FCB field, a name with characters after the padding
+// is invalid
+static bool copy_fcb_field(const uint8_t* field, const int size, char* name,
+                           int* len)
+{
+    bool padding = false;
+    for(int i = 0; i < size; i++) {
+        // The high bits are file attributes
+        const char c = (char)(field[i] & 0x7F);
+        if(c == ' ') {
+            padding = true;
+            continue;
+        }
+        if(padding || !valid_name_char(c)) {
+            return false;
+        }
+        name[(*len)++] = (char)tolower(c);
+    }
+    return true;
+}
+
+static bool fcb_to_host_name(const uint8_t* memory, const uint16_t fcb,
+                             char* name)
+{
+    int len = 0;
+    if(!copy_fcb_field(&memory[fcb + FCB_NAME], 8, name, &len) || len == 0) {
+        return false;
+    }
+
+    name[len++] = '.';
+    if(!copy_fcb_field(&memory[fcb + FCB_TYPE], 3, name, &len)) {
+        return false;
+    }
+
+    if(name[len - 1] == '.') {
+        len--;
+    }
+    name[len] = '\0';
+    return true;
+}
+
+static uint8_t open_file(uint8_t* memory, const uint16_t fcb, const char* mode)
+{
+    char name[HOST_NAME_SIZE];
+    if(!fcb_to_host_name(memory, fcb, name)) {
+        return BDOS_ERROR;
+    }
+
+    open_file_t* slot = find_file(fcb);
+    if(slot != NULL) {
+        fclose(slot->file);
+        slot->file = NULL;
+    }
+
+    for(int i = 0; i < MAX_OPEN_FILES && slot == NULL; i++) {
+        if(open_files[i].file == NULL) {
+            slot = &open_files[i];
+        }
+    }
+    if(slot == NULL) {
+        return BDOS_ERROR;
+    }
+
+    FILE* file = fopen(name, mode);
+    if(file == NULL) {
+        return BDOS_ERROR;
+    }
+    setvbuf(file, NULL, _IOFBF, HOST_BUFFER_SIZE);
+
+    slot->file = file;
+    slot->position = 0;
+    slot->last_access = ACCESS_NONE;
+    slot->fcb = fcb;
+
+    memory[fcb + FCB_EXTENT] = 0;
+    memory[fcb + FCB_MODULE] = 0;
+    memory[fcb + FCB_RECORD_COUNT] = 0;
+    memory[fcb + FCB_CURRENT_RECORD] = 0;
+    video_mark_dirty_range(fcb, FCB_SIZE);
+    return 0;
+}
+
+static uint8_t close_file(const uint16_t fcb)
+{
+    open_file_t* slot = find_file(fcb);
+    if(slot == NULL) {
+        return BDOS_ERROR;
+    }
+    const int ret = fclose(slot->file);
+    slot->file = NULL;
+    return ret == 0 ? 0 : BDOS_ERROR;
+}
+
+static uint8_t delete_file(const uint8_t* memory, const uint16_t fcb)
+{
+    char name[HOST_NAME_SIZE];
+    if(!fcb_to_host_name(memory, fcb, name)) {
+        return BDOS_ERROR;
+    }
+    return remove(name) == 0 ? 0 : BDOS_ERROR;
+}
+
+static long sequential_record(const uint8_t* memory, const uint16_t fcb)
+{
+    return ((long)memory[fcb + FCB_MODULE] * EXTENTS_PER_MODULE
+            + memory[fcb + FCB_EXTENT])
+               * RECORDS_PER_EXTENT
+           + memory[fcb + FCB_CURRENT_RECORD];
+}
+
+static void set_sequential_record(uint8_t* memory, const uint16_t fcb,
+                                  const long record)
+{
+    memory[fcb + FCB_CURRENT_RECORD] = record % RECORDS_PER_EXTENT;
+    memory[fcb + FCB_EXTENT]
+        = (record / RECORDS_PER_EXTENT) % EXTENTS_PER_MODULE;
+    memory[fcb + FCB_MODULE]
+        = record / (RECORDS_PER_EXTENT * EXTENTS_PER_MODULE);
+    video_mark_dirty_range(fcb, FCB_SIZE);
+}
+
+static long random_record(const uint8_t* memory, const uint16_t fcb)
+{
+    return ADDRESS(memory[fcb + FCB_RANDOM_RECORD + 1],
+                   memory[fcb + FCB_RANDOM_RECORD]);
+}
+
+static void set_random_record(uint8_t* memory, const uint16_t fcb,
+                              const long record)
+{
+    memory[fcb + FCB_RANDOM_RECORD] = record & 0xFF;
+    memory[fcb + FCB_RANDOM_RECORD + 1] = (record >> 8) & 0xFF;
+    memory[fcb + FCB_RANDOM_RECORD + 2] = (record >> 16) & 0xFF;
+    video_mark_dirty_range(fcb, FCB_SIZE);
+}
+
+// Seeks the host file to `record`, skipping the seek for sequential access
+// in the same direction. stdio requires a seek when switching between reads
+// and writes.
+static open_file_t* seek_record(const uint16_t fcb, const long record,
+                                const access_t access)
+{
+    open_file_t* slot = find_file(fcb);
+    if(slot == NULL) {
+        return NULL;
+    }
+
+    const long position = record * CPM_RECORD_SIZE;
+    if(position != slot->position || access != slot->last_access) {
+        if(fseek(slot->file, position, SEEK_SET) != 0) {
+            slot->position = -1;
+            return NULL;
+        }
+        slot->position = position;
+    }
+    slot->last_access = access;
+    return slot;
+}
+
+// Returns 0 on success, 1 at the end of the file
+static uint8_t read_record(uint8_t* memory, const uint16_t fcb,
+                           const long record)
+{
+    if(!fits(dma, CPM_RECORD_SIZE)) {
+        return BDOS_ERROR;
+    }
+    open_file_t* slot = seek_record(fcb, record, ACCESS_READ);
+    if(slot == NULL) {
+        return BDOS_ERROR;
+    }
+
+    const size_t read = fread(&memory[dma], 1, CPM_RECORD_SIZE, slot->file);
+    slot->position += (long)read;
+    // The guest may keep its DMA buffer in video RAM
+    video_mark_dirty_range(dma, CPM_RECORD_SIZE);
+    if(read == 0) {
+        return 1;
+    }
+    // Partial records are padded with ^Z like CP/M text files
+    for(size_t i = read; i < CPM_RECORD_SIZE; i++) {
+        memory[dma + i] = CPM_EOF;
+    }
+    return 0;
+}
+
+// Returns 0 on success, 2 when the host write fails
+static uint8_t write_record(const uint8_t* memory, const uint16_t fcb,
+                            const long record)
+{
+    if(!fits(dma, CPM_RECORD_SIZE)) {
+        return BDOS_ERROR;
+    }
+    open_file_t* slot = seek_record(fcb, record, ACCESS_WRITE);
+    if(slot == NULL) {
+        return BDOS_ERROR;
+    }
+
+    const size_t written
+        = fwrite(&memory[dma], 1, CPM_RECORD_SIZE, slot->file);
+    slot->position += (long)written;
+    return written == CPM_RECORD_SIZE ? 0 : 2;
+}
+
+static uint8_t read_sequential(uint8_t* memory, const uint16_t fcb)
+{
+    const long record = sequential_record(memory, fcb);
+    const uint8_t result = read_record(memory, fcb, record);
+    if(result == 0) {
+        set_sequential_record(memory, fcb, record + 1);
+    }
+    return result;
+}
+
+static uint8_t write_sequential(uint8_t* memory, const uint16_t fcb)
+{
+    const long record = sequential_record(memory, fcb);
+    const uint8_t result = write_record(memory, fcb, record);
+    if(result == 0) {
+        set_sequential_record(memory, fcb, record + 1);
+    }
+    return result;
+}
+
+// Random access leaves the sequential position at the accessed record, as
+// CP/M does. Returns 6 when the record is past the 16 bit range.
+static uint8_t read_random(uint8_t* memory, const uint16_t fcb)
+{
+    if(memory[fcb + FCB_RANDOM_RECORD + 2] != 0) {
+        return 6;
+    }
+    const long record = random_record(memory, fcb);
+    set_sequential_record(memory, fcb, record);
+    return read_record(memory, fcb, record);
+}
+
+static uint8_t write_random(uint8_t* memory, const uint16_t fcb)
+{
+    if(memory[fcb + FCB_RANDOM_RECORD + 2] != 0) {
+        return 6;
+    }
+    const long record = random_record(memory, fcb);
+    set_sequential_record(memory, fcb, record);
+    return write_record(memory, fcb, record);
+}
+
+static uint8_t compute_file_size(uint8_t* memory, const uint16_t fcb)
+{
+    long size = -1;
+    open_file_t* slot = find_file(fcb);
+    if(slot != NULL) {
+        if(fflush(slot->file) == 0 && fseek(slot->file, 0, SEEK_END) == 0) {
+            size = ftell(slot->file);
+        }
+        // The next access has to seek again
+        slot->position = -1;
+    } else {
+        char name[HOST_NAME_SIZE];
+        if(!fcb_to_host_name(memory, fcb, name)) {
+            return BDOS_ERROR;
+        }
+        FILE* file = fopen(name, "rb");
+        if(file == NULL) {
+            return BDOS_ERROR;
+        }
+        if(fseek(file, 0, SEEK_END) == 0) {
+            size = ftell(file);
+        }
+        fclose(file);
+    }
+
+    if(size < 0) {
+        return BDOS_ERROR;
+    }
+    set_random_record(memory, fcb,
+                      (size + CPM_RECORD_SIZE - 1) / CPM_RECORD_SIZE);
+    return 0;
+}
+
+static uint8_t read_console_buffer(uint8_t* memory, const uint16_t buffer)
+{
+    // Buffer layout: maximum length, returned length, characters
+    if(!fits(buffer, 2) || !fits(buffer, 2 + memory[buffer])) {
+        return BDOS_ERROR;
+    }
+
+    const uint8_t max = memory[buffer];
+    uint8_t count = 0;
+    while(count < max) {
+        const int c = getchar();
+        if(c == EOF || c == '\n' || c == '\r') {
+            break;
+        }
+        memory[buffer + 2 + count] = (uint8_t)c;
+        count++;
+    }
+    memory[buffer + 1] = count;
+    video_mark_dirty_range(buffer + 1, 1 + count);
+    return 0;
+}
+
+static bool uses_fcb(const uint8_t function)
+{
+    switch(function) {
+        case BDOS_OPEN_FILE:
+        case BDOS_CLOSE_FILE:
+        case BDOS_DELETE_FILE:
+        case BDOS_READ_SEQUENTIAL:
+        case BDOS_WRITE_SEQUENTIAL:
+        case BDOS_MAKE_FILE:
+        case BDOS_READ_RANDOM:
+        case BDOS_WRITE_RANDOM:
+        case BDOS_COMPUTE_FILE_SIZE:
+        case BDOS_SET_RANDOM_RECORD:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static uint8_t service(const uint8_t* registers, uint8_t* memory,
+                       const uint8_t function, const uint16_t DE)
+{
+    uint8_t result = 0;
+
+    switch(function) {
+        case BDOS_CONSOLE_INPUT: {
+            const int c = getchar();
+            result = c == EOF ? CPM_EOF : (uint8_t)c;
+            break;
+        }
+        case BDOS_CONSOLE_OUTPUT:
+            putchar(registers[REG_E]);
+            break;
+        case BDOS_PRINT_STRING:
+            for(uint32_t address = DE;
+                address < MAX_MEMORY_SIZE && memory[address] != '$';
+                address++) {
+                putchar(memory[address]);
+            }
+            break;
+        case BDOS_READ_CONSOLE_BUFFER:
+            result = read_console_buffer(memory, DE);
+            break;
+        case BDOS_CONSOLE_STATUS:
+            result = 0;
+            break;
+        case BDOS_VERSION:
+            // CP/M 2.2
+            result = 0x22;
+            break;
+        case BDOS_OPEN_FILE:
+            result = open_file(memory, DE, "r+b");
+            if(result != 0) {
+                result = open_file(memory, DE, "rb");
+            }
+            break;
+        case BDOS_CLOSE_FILE:
+            result = close_file(DE);
+            break;
+        case BDOS_DELETE_FILE:
+            result = delete_file(memory, DE);
+            break;
+        case BDOS_READ_SEQUENTIAL:
+            result = read_sequential(memory, DE);
+            break;
+        case BDOS_WRITE_SEQUENTIAL:
+            result = write_sequential(memory, DE);
+            break;
+        case BDOS_MAKE_FILE:
+            result = open_file(memory, DE, "w+b");
+            break;
+        case BDOS_SET_DMA:
+            dma = DE;
+            break;
+        case BDOS_READ_RANDOM:
+            result = read_random(memory, DE);
+            break;
+        case BDOS_WRITE_RANDOM:
+            result = write_random(memory, DE);
+            break;
+        case BDOS_COMPUTE_FILE_SIZE:
+            result = compute_file_size(memory, DE);
+            break;
+        case BDOS_SET_RANDOM_RECORD:
+            set_random_record(memory, DE, sequential_record(memory, DE));
+            break;
+        default:
+            if(!reported_unsupported[function]) {
+                reported_unsupported[function] = true;
+                fprintf(stderr, "bdos: unsupported function %d\n",
+                        function);
+            }
+            result = BDOS_ERROR;
+            break;
+    }
+
+    return result;
+}
+
+bool bdos_call(uint8_t* registers, uint8_t* memory, uint16_t* SP,
+               uint16_t* PC)
+{
+    const uint8_t function = registers[REG_C];
+    const uint16_t DE = ADDRESS(registers[REG_D], registers[REG_E]);
+
+    if(function == BDOS_SYSTEM_RESET) {
+        bdos_reset();
+        *PC = 0;
+        return false;
+    }
+
+    uint8_t result = BDOS_ERROR;
+    if(!uses_fcb(function) || fits(DE, FCB_SIZE)) {
+        result = service(registers, memory, function, DE);
+    }
+
+    // Single byte results are returned in both A and L, with B and H cleared
+    registers[REG_A] = result;
+    registers[REG_L] = result;
+    registers[REG_B] = 0;
+    registers[REG_H] = 0;
+
+    // Return to the guest as the RET at the end of the BDOS would, a stack
+    // outside of memory can only be recovered with a warm boot
+    if(!fits(*SP, 2)) {
+        *PC = 0;
+        return false;
+    }
+    *PC = ADDRESS(memory[*SP + 1], memory[*SP]);
+    (*SP) += 2;
+    return true;
+}
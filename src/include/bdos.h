@@ -0,0 +1,40 @@
+#ifndef BDOS_H
+#define BDOS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// CP/M programs enter the BDOS with CALL 0005h, function number in C and
+// parameter in E or DE
+#define BDOS_ENTRY 0x0005
+#define BDOS_DEFAULT_DMA 0x0080
+
+#define BDOS_SYSTEM_RESET 0
+#define BDOS_CONSOLE_INPUT 1
+#define BDOS_CONSOLE_OUTPUT 2
+#define BDOS_PRINT_STRING 9
+#define BDOS_READ_CONSOLE_BUFFER 10
+#define BDOS_CONSOLE_STATUS 11
+#define BDOS_VERSION 12
+#define BDOS_OPEN_FILE 15
+#define BDOS_CLOSE_FILE 16
+#define BDOS_DELETE_FILE 19
+#define BDOS_READ_SEQUENTIAL 20
+#define BDOS_WRITE_SEQUENTIAL 21
+#define BDOS_MAKE_FILE 22
+#define BDOS_SET_DMA 26
+#define BDOS_READ_RANDOM 33
+#define BDOS_WRITE_RANDOM 34
+#define BDOS_COMPUTE_FILE_SIZE 35
+#define BDOS_SET_RANDOM_RECORD 36
+
+void bdos_reset();
+
+// Services the BDOS function requested by the guest directly on the host and
+// sets PC to the popped return address. Returns false when the guest
+// terminated (system reset, or a stack outside of memory), PC is then 0 as
+// for a CP/M warm boot.
+bool bdos_call(uint8_t* registers, uint8_t* memory, uint16_t* SP,
+               uint16_t* PC);
+
+#endif // BDOS_H
@@ -0,0 +1,222 @@
+// Template for one core variant. intel-8080.c includes it once per variant
+// with these defined:
+//   CPU_STEP_NAME   name of the generated step function
+//   CPU_RUN_NAME    name of the generated cpu_run() loop
+//   CPU_CORE_CYCLES 1 to keep the instruction timing so that cpu_step()
+//                   advances one clock cycle, 0 to run a whole instruction
+//                   per step
+//   CPU_CORE_HOOKS  1 to track writes to video RAM, 0 to skip it entirely
+// The BDOS trap is part of the machine rather than instrumentation, every
+// variant checks it.
+
+#if CPU_CORE_CYCLES
+#define CPU_CYCLES(cycles)                                                     \
+    do {                                                                       \
+        busy_cycles = (int8_t)(cycles);                                        \
+        cycle_count += (uint64_t)busy_cycles;                                  \
+    } while(0)
+#else
+#define CPU_CYCLES(cycles) (void)(cycles)
+#endif
+
+#if CPU_CORE_HOOKS
+#define CPU_MEMORY_WRITE(address) video_mark_dirty(address)
+#else
+#define CPU_MEMORY_WRITE(address) (void)0
+#endif
+
+// Only called once the previous instruction has finished, cpu_step() counts
+// down the cycles in between. Returns false once the guest has terminated.
+static bool CPU_STEP_NAME()
+{
+    instruction_count++;
+
+    if(bdos_trap && PC == BDOS_ENTRY) {
+        if(!bdos_call(registers, memory, &SP, &PC)) {
+            halt();
+            return false;
+        }
+        // Account for the RET that ends the BDOS call
+        CPU_CYCLES(10);
+        return true;
+    }
+
+    uint8_t opcode = memory[PC];
+
+    switch(opcode) {
+        case 0b00110110: // Move to memory immediate
+            CPU_MEMORY_WRITE(ADDRESS(registers[REG_H], registers[REG_L]));
+            CPU_CYCLES(MVI_mem(registers, memory, memory[PC + 1]));
+            PC += 2;
+            break;
+        case 0b00111010: // Load accumulator direct
+            CPU_CYCLES(LDA(registers, memory,
+                           ADDRESS(memory[PC + 2], memory[PC + 1])));
+            PC += 3;
+            break;
+        case 0b00110010: // Store accumulator direct
+            CPU_MEMORY_WRITE(ADDRESS(memory[PC + 2], memory[PC + 1]));
+            CPU_CYCLES(STA(registers, memory,
+                           ADDRESS(memory[PC + 2], memory[PC + 1])));
+            PC += 3;
+            break;
+        case 0b00101010: // Load H and L direct
+            CPU_CYCLES(LHLD(registers, memory,
+                            ADDRESS(memory[PC + 2], memory[PC + 1])));
+            PC += 3;
+            break;
+        case 0b00100010: // Store H and L direct
+            CPU_MEMORY_WRITE(ADDRESS(memory[PC + 2], memory[PC + 1]));
+            CPU_MEMORY_WRITE(ADDRESS(memory[PC + 2], memory[PC + 1]) + 1);
+            CPU_CYCLES(SHLD(registers, memory,
+                            ADDRESS(memory[PC + 2], memory[PC + 1])));
+            PC += 3;
+            break;
+        case 0b11101011: // Exchange H and L with D and E
+            CPU_CYCLES(XCHG(registers));
+            PC += 1;
+            break;
+        case 0b10000110: // Add memory
+            CPU_CYCLES(ADD_mem(registers, memory, &flags));
+            PC += 1;
+            break;
+        case 0b11000110: // Add immediate
+            CPU_CYCLES(ADI(registers, memory[PC + 1], &flags));
+            PC += 2;
+            break;
+        case 0b10001110: // Add memory with carry
+            CPU_CYCLES(ADC_mem(registers, memory, &flags));
+            PC += 1;
+            break;
+        case 0b11001110: // Add immediate with carry
+            CPU_CYCLES(ACI(registers, memory[PC + 1], &flags));
+            PC += 2;
+            break;
+        case 0b10010110: // Subtract memory
+            CPU_CYCLES(SUB_mem(registers, memory, &flags));
+            PC += 1;
+            break;
+        case 0b11010110:  // Subtract immediate
+            CPU_CYCLES(SUI(registers, memory[PC + 1], &flags));
+            PC += 2;
+            break;
+        case 0b10011110: // Subtract memory with borrow
+            CPU_CYCLES(SBB_mem(registers, memory, &flags));
+            PC += 1;
+            break;
+        case 0b11011110: //  Subtract immediate with borrow
+            CPU_CYCLES(SBI(registers, memory[PC + 1], &flags));
+            PC += 2;
+            break;
+        case 0b00110100: // Increment memory
+            CPU_MEMORY_WRITE(ADDRESS(registers[REG_H], registers[REG_L]));
+            CPU_CYCLES(INR_mem(registers, memory, &flags));
+            PC += 1;
+            break;
+        case 0b00110101: // Decrement memory
+            CPU_MEMORY_WRITE(ADDRESS(registers[REG_H], registers[REG_L]));
+            CPU_CYCLES(DCR_mem(registers, memory, &flags));
+            PC += 1;
+            break;
+        case 0b00100111: // Decimal Adjust Accumulator
+            CPU_CYCLES(DDA(registers, &flags));
+            PC += 1;
+            break;
+        case 0b10100110: // AND memory
+            CPU_CYCLES(ANA_mem(registers, memory, &flags));
+            PC += 1;
+            break;
+        case 0b11100110: // AND immediate
+            CPU_CYCLES(ANI(registers, memory[PC + 1], &flags));
+            PC += 2;
+            break;
+        case 0b10101110: // XOR memory
+            CPU_CYCLES(XRA_mem(registers, memory, &flags));
+            PC += 1;
+            break;
+        case 0b11101110: // XOR immediate
+            CPU_CYCLES(XRI(registers, memory[PC + 1], &flags));
+            PC += 2;
+            break;
+        case 0b10110110: // OR memory
+            CPU_CYCLES(ORA_mem(registers, memory, &flags));
+            PC += 1;
+            break;
+        case 0b11110110: // OR immediate
+            CPU_CYCLES(ORI(registers, memory[PC + 1], &flags));
+            PC += 2;
+            break;
+        case 0b10111110: // Compare memory
+            CPU_CYCLES(CMP_mem(registers, memory, &flags));
+            PC += 1;
+            break;
+        case 0b11111110: // Compare memory immediate
+            CPU_CYCLES(CPI(registers, memory[PC + 1], &flags));
+            PC += 2;
+            break;
+        case 0b00000111: // Rotate left
+            CPU_CYCLES(RLC(registers, &flags));
+            PC += 1;
+            break;
+        case 0b00001111: // Rotate right
+            CPU_CYCLES(RRC(registers, &flags));
+            PC += 1;
+            break;
+        case 0b00010111: // Rotate left through carry
+            CPU_CYCLES(RAL(registers, &flags));
+            PC += 1;
+            break;
+        case 0b00011111: // Rotate right through carry
+            CPU_CYCLES(RAR(registers, &flags));
+            PC += 1;
+            break;
+        case 0b00101111: // Complement accumulator
+            CPU_CYCLES(CMA(registers));
+            PC += 1;
+            break;
+        case 0b00111111: // Complement carry
+            CPU_CYCLES(CMC(&flags));
+            PC += 1;
+            break;
+        case 0b00110111: // Set carry
+            CPU_CYCLES(STC(&flags));
+            PC += 1;
+            break;
+        case 0b11000011: // Jump
+            CPU_CYCLES(JMP(memory[PC + 1], memory[PC + 2], &PC));
+            break;
+        default:
+            // TODO: Handle unknown instruction
+            break;
+    }
+    return true;
+}
+
+static void CPU_RUN_NAME(const uint64_t steps)
+{
+    for(uint64_t i = 0; i < steps;) {
+#if CPU_CORE_CYCLES
+        // Skip the remaining cycles of the current instruction in one go
+        if(busy_cycles > 1) {
+            uint64_t idle = (uint64_t)(busy_cycles - 1);
+            if(idle > steps - i) {
+                idle = steps - i;
+            }
+            busy_cycles -= (int8_t)idle;
+            i += idle;
+            continue;
+        }
+#endif
+        if(!CPU_STEP_NAME()) {
+            return;
+        }
+        i++;
+    }
+}
+
+#undef CPU_CYCLES
+#undef CPU_MEMORY_WRITE
+#undef CPU_STEP_NAME
+#undef CPU_RUN_NAME
+#undef CPU_CORE_CYCLES
+#undef CPU_CORE_HOOKS
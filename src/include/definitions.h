@@ -20,6 +20,8 @@
 #define REG_H 0b100
 #define REG_L 0b101
 
+#define MAX_MEMORY_SIZE 65535
+
 #define ADDRESS(h, l) (((h) << 8) | (l))
 #define FLAG_OPERATION_ADDITION true
 #define FLAG_OPERATION_SUBTRACTION false
@@ -1,9 +1,42 @@
 #ifndef INTEL_8080_H
 #define INTEL_8080_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+// Core variants, cpu_step() either advances a single clock cycle
+// (CPU_VARIANT_CYCLES) or runs a whole instruction, and only tracks video RAM
+// writes with CPU_VARIANT_HOOKS
+#define CPU_VARIANT_FAST 0
+#define CPU_VARIANT_CYCLES (1 << 0)
+#define CPU_VARIANT_HOOKS (1 << 1)
+#define CPU_VARIANT_ACCURATE (CPU_VARIANT_CYCLES | CPU_VARIANT_HOOKS)
+
+typedef struct cpu_state_t {
+    uint8_t registers[8];
+    uint8_t flags;
+    uint16_t SP;
+    uint16_t PC;
+} cpu_state_t;
+
 void cpu_init();
 void cpu_step();
+// Same as calling cpu_step() `steps` times, but loops inside the variant
+void cpu_run(uint64_t steps);
+void cpu_enable_bdos_trap(bool enable);
+// True once the guest has terminated through the BDOS trap (system reset, or
+// a BDOS call with the stack outside of memory). Stepping does nothing until
+// the next cpu_init().
+bool cpu_halted();
+// Loads a program image, e.g. a CP/M .COM file at 0100h, and starts
+// execution at its first byte. Returns false if the file can't be read or
+// doesn't fit.
+bool cpu_load_program(const char* path, uint16_t address);
+void cpu_set_variant(uint8_t variant);
+// Counted since cpu_init(), cycles only by variants with CPU_VARIANT_CYCLES
+uint64_t cpu_instruction_count();
+uint64_t cpu_cycle_count();
+void cpu_get_state(cpu_state_t* state);
+void cpu_set_state(const cpu_state_t* state);
 
 #endif
@@ -0,0 +1,53 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// 1bpp framebuffer of the arcade board. Every 32 byte line of video RAM is
+// one column of the screen, bottom to top, which is rotated to an upright
+// 224x256 RGBA frame.
+#define VIDEO_RAM_START 0x2400
+#define VIDEO_RAM_SIZE 0x1C00
+#define VIDEO_BYTES_PER_LINE 32
+#define VIDEO_LINES (VIDEO_RAM_SIZE / VIDEO_BYTES_PER_LINE)
+#define VIDEO_WIDTH VIDEO_LINES
+#define VIDEO_HEIGHT (VIDEO_BYTES_PER_LINE * 8)
+#define VIDEO_DIRTY_WORDS ((VIDEO_LINES + 31) / 32)
+
+// RGBA, stored as bytes R, G, B, A
+#define VIDEO_FOREGROUND 0xFFFFFFFFU
+#define VIDEO_BACKGROUND 0xFF000000U
+
+// lines written since the last video_render(), one bit per line
+extern uint32_t video_dirty_lines[VIDEO_DIRTY_WORDS];
+
+inline void video_mark_dirty(const uint16_t address)
+{
+    const uint16_t offset = address - VIDEO_RAM_START;
+    if(offset < VIDEO_RAM_SIZE) {
+        const uint16_t line = offset / VIDEO_BYTES_PER_LINE;
+        video_dirty_lines[line / 32] |= (1U << (line % 32));
+    }
+}
+
+// Marks the lines overlapping [address, address + size), for guest memory
+// written outside of the core such as BDOS reads into the DMA buffer
+void video_mark_dirty_range(uint16_t address, uint32_t size);
+
+void video_init();
+
+// Marks every line dirty, for writes the core doesn't track (e.g. when
+// running without hooks)
+void video_invalidate();
+
+// Emulation side: converts the dirty lines into the back buffer and
+// publishes it. Returns false, keeping the lines dirty, when the presenter
+// still holds the back buffer.
+bool video_render(const uint8_t* memory);
+
+// Presenter side: the frame stays valid until video_release_frame()
+const uint32_t* video_acquire_frame();
+void video_release_frame();
+
+#endif // VIDEO_H
@@ -1,7 +1,8 @@
 #include "include/intel-8080.h"
+#include "include/bdos.h"
 #include "include/instructions.h"
-
-#define MAX_MEMORY_SIZE 65535
+#include "include/video.h"
+#include <stdio.h>
 
 // registers
 static uint8_t registers[8];
@@ -22,159 +23,178 @@ uint8_t memory[MAX_MEMORY_SIZE];
 // cycles until current instruction is finished
 static int8_t busy_cycles = 0;
 
+// executed instructions and, in the cycle accounting variants, their cycles
+static uint64_t instruction_count = 0;
+static uint64_t cycle_count = 0;
+
+// service CP/M system calls on the host instead of running a guest BDOS
+static bool bdos_trap = false;
+
+// set once the guest has terminated through the BDOS, see halt()
+static bool halted = false;
+
+static void halt();
+static void select_variant();
+
 void cpu_init()
 {
     PC = 0;
     flags = 0b00000010;
+    busy_cycles = 0;
+    instruction_count = 0;
+    cycle_count = 0;
+    halted = false;
+    select_variant();
+}
+
+bool cpu_halted()
+{
+    return halted;
+}
+
+bool cpu_load_program(const char* path, const uint16_t address)
+{
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) {
+        return false;
+    }
+
+    const size_t space = MAX_MEMORY_SIZE - address;
+    const size_t size = fread(&memory[address], 1, space, file);
+    // Anything left over doesn't fit in memory
+    const bool loaded = !ferror(file) && fgetc(file) == EOF;
+    fclose(file);
+    if(!loaded) {
+        return false;
+    }
+
+    video_mark_dirty_range(address, (uint32_t)size);
+    PC = address;
+    return true;
+}
+
+uint64_t cpu_instruction_count()
+{
+    return instruction_count;
+}
+
+uint64_t cpu_cycle_count()
+{
+    return cycle_count;
+}
+
+void cpu_get_state(cpu_state_t* state)
+{
+    for(int i = 0; i < 8; i++) {
+        state->registers[i] = registers[i];
+    }
+    state->flags = flags;
+    state->SP = SP;
+    state->PC = PC;
+}
+
+void cpu_set_state(const cpu_state_t* state)
+{
+    for(int i = 0; i < 8; i++) {
+        registers[i] = state->registers[i];
+    }
+    flags = state->flags;
+    SP = state->SP;
+    PC = state->PC;
+}
+
+void cpu_enable_bdos_trap(bool enable)
+{
+    bdos_trap = enable;
+    bdos_reset();
+}
+
+// Every combination of cycle accounting and hooks is generated from the same
+// source so that no variant pays for what it doesn't use
+#define CPU_STEP_NAME step_fast
+#define CPU_RUN_NAME run_fast
+#define CPU_CORE_CYCLES 0
+#define CPU_CORE_HOOKS 0
+#include "include/cpu-core.h"
+
+#define CPU_STEP_NAME step_cycles
+#define CPU_RUN_NAME run_cycles
+#define CPU_CORE_CYCLES 1
+#define CPU_CORE_HOOKS 0
+#include "include/cpu-core.h"
+
+#define CPU_STEP_NAME step_hooks
+#define CPU_RUN_NAME run_hooks
+#define CPU_CORE_CYCLES 0
+#define CPU_CORE_HOOKS 1
+#include "include/cpu-core.h"
+
+#define CPU_STEP_NAME step_accurate
+#define CPU_RUN_NAME run_accurate
+#define CPU_CORE_CYCLES 1
+#define CPU_CORE_HOOKS 1
+#include "include/cpu-core.h"
+
+typedef struct variant_t {
+    bool (*step)();
+    void (*run)(uint64_t steps);
+} variant_t;
+
+static const variant_t variants[] = {
+    [CPU_VARIANT_FAST] = { step_fast, run_fast },
+    [CPU_VARIANT_CYCLES] = { step_cycles, run_cycles },
+    [CPU_VARIANT_HOOKS] = { step_hooks, run_hooks },
+    [CPU_VARIANT_ACCURATE] = { step_accurate, run_accurate },
+};
+
+// A terminated guest doesn't run any further until cpu_init()
+static bool step_halted()
+{
+    return false;
+}
+
+static void run_halted(uint64_t steps)
+{
+    (void)steps;
+}
+
+static const variant_t halted_variant = { step_halted, run_halted };
+
+static uint8_t selected_variant = CPU_VARIANT_ACCURATE;
+static const variant_t* variant = &variants[CPU_VARIANT_ACCURATE];
+
+static void select_variant()
+{
+    variant = halted ? &halted_variant : &variants[selected_variant];
+}
+
+// Swapping in the halted variant keeps the check off the step and run loops
+static void halt()
+{
+    halted = true;
+    busy_cycles = 0;
+    select_variant();
+}
+
+void cpu_set_variant(uint8_t selected)
+{
+    selected_variant = selected & CPU_VARIANT_ACCURATE;
+    busy_cycles = 0;
+    select_variant();
 }
 
 void cpu_step()
 {
-    busy_cycles--;
-    if(busy_cycles > 0) {
+    // Cycles spent inside an instruction don't need to go through the
+    // variant at all
+    if(busy_cycles > 1) {
+        busy_cycles--;
         return;
     }
+    variant->step();
+}
 
-    uint8_t opcode = memory[PC];
-
-    switch(opcode) {
-        case 0b00110110: // Move to memory immediate
-            busy_cycles = MVI_mem(registers, memory, memory[PC + 1]);
-            PC += 2;
-            break;
-        case 0b00111010: // Load accumulator direct
-            busy_cycles = LDA(registers, memory,
-                              ADDRESS(memory[PC + 2], memory[PC + 1]));
-            PC += 3;
-            break;
-        case 0b00110010: // Store accumulator direct
-            busy_cycles = STA(registers, memory,
-                              ADDRESS(memory[PC + 2], memory[PC + 1]));
-            PC += 3;
-            break;
-        case 0b00101010: // Load H and L direct
-            busy_cycles = LHLD(registers, memory,
-                               ADDRESS(memory[PC + 2], memory[PC + 1]));
-            PC += 3;
-            break;
-        case 0b00100010: // Store H and L direct
-            busy_cycles = SHLD(registers, memory,
-                               ADDRESS(memory[PC + 2], memory[PC + 1]));
-            PC += 3;
-            break;
-        case 0b11101011: // Exchange H and L with D and E
-            busy_cycles = XCHG(registers);
-            PC += 1;
-            break;
-        case 0b10000110: // Add memory
-            busy_cycles = ADD_mem(registers, memory, &flags);
-            PC += 1;
-            break;
-        case 0b11000110: // Add immediate
-            busy_cycles = ADI(registers, memory[PC + 1], &flags);
-            PC += 2;
-            break;
-        case 0b10001110: // Add memory with carry
-            busy_cycles = ADC_mem(registers, memory, &flags);
-            PC += 1;
-            break;
-        case 0b11001110: // Add immediate with carry
-            busy_cycles = ACI(registers, memory[PC + 1], &flags);
-            PC += 2;
-            break;
-        case 0b10010110: // Subtract memory
-            busy_cycles = SUB_mem(registers, memory, &flags);
-            PC += 1;
-            break;
-        case 0b11010110:  // Subtract immediate
-            busy_cycles = SUI(registers, memory[PC + 1], &flags);
-            PC += 2;
-            break;
-        case 0b10011110: // Subtract memory with borrow
-            busy_cycles = SBB_mem(registers, memory, &flags);
-            PC += 1;
-            break;
-        case 0b11011110: //  Subtract immediate with borrow
-            busy_cycles = SBI(registers, memory[PC + 1], &flags);
-            PC += 2;
-            break;
-        case 0b00110100: // Increment memory
-            busy_cycles = INR_mem(registers, memory, &flags);
-            PC += 1;
-            break;
-        case 0b00110101: // Decrement memory
-            busy_cycles = DCR_mem(registers, memory, &flags);
-            PC += 1;
-            break;
-        case 0b00100111: // Decimal Adjust Accumulator
-            busy_cycles = DDA(registers, &flags);
-            PC += 1;
-            break;
-        case 0b10100110: // AND memory
-            busy_cycles = ANA_mem(registers, memory, &flags);
-            PC += 1;
-            break;
-        case 0b11100110: // AND immediate
-            busy_cycles = ANI(registers, memory[PC + 1], &flags);
-            PC += 2;
-            break;
-        case 0b10101110: // XOR memory
-            busy_cycles = XRA_mem(registers, memory, &flags);
-            PC += 1;
-            break;
-        case 0b11101110: // XOR immediate
-            busy_cycles = XRI(registers, memory[PC + 1], &flags);
-            PC += 2;
-            break;
-        case 0b10110110: // OR memory
-            busy_cycles = ORA_mem(registers, memory, &flags);
-            PC += 1;
-            break;
-        case 0b11110110: // OR immediate
-            busy_cycles = ORI(registers, memory[PC + 1], &flags);
-            PC += 2;
-            break;
-        case 0b10111110: // Compare memory
-            busy_cycles = CMP_mem(registers, memory, &flags);
-            PC += 1;
-            break;
-        case 0b11111110: // Compare memory immediate
-            busy_cycles = CPI(registers, memory[PC + 1], &flags);
-            PC += 2;
-            break;
-        case 0b00000111: // Rotate left
-            busy_cycles = RLC(registers, &flags);
-            PC += 1;
-            break;
-        case 0b00001111: // Rotate right
-            busy_cycles = RRC(registers, &flags);
-            PC += 1;
-            break;
-        case 0b00010111: // Rotate left through carry
-            busy_cycles = RAL(registers, &flags);
-            PC += 1;
-            break;
-        case 0b00011111: // Rotate right through carry
-            busy_cycles = RAR(registers, &flags);
-            PC += 1;
-            break;
-        case 0b00101111: // Complement accumulator
-            busy_cycles = CMA(registers);
-            PC += 1;
-            break;
-        case 0b00111111: // Complement carry
-            busy_cycles = CMC(&flags);
-            PC += 1;
-            break;
-        case 0b00110111: // Set carry
-            busy_cycles = STC(&flags);
-            PC += 1;
-            break;
-        case 0b11000011: // Jump
-            busy_cycles = JMP(memory[PC + 1], memory[PC + 2], &PC);
-            break;
-        default:
-            // TODO: Handle unknown instruction
-            break;
-    }
+void cpu_run(uint64_t steps)
+{
+    variant->run(steps);
 }
@@ -0,0 +1,176 @@
+#include "include/video.h"
+#include <stdatomic.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define NO_FRAME (-1)
+
+// Adjacent lines converted together, their pixels on a row are contiguous
+#define VIDEO_GROUP_LINES 8
+
+extern inline void video_mark_dirty(uint16_t address);
+
+uint32_t video_dirty_lines[VIDEO_DIRTY_WORDS];
+
+// Each buffer keeps its own dirty lines since it misses the updates
+// rendered into the other one
+static uint32_t frames[2][VIDEO_WIDTH * VIDEO_HEIGHT];
+static uint32_t frame_dirty_lines[2][VIDEO_DIRTY_WORDS];
+
+// front is only written by the emulation side, reading only by the presenter
+static atomic_int front = 0;
+static atomic_int reading = NO_FRAME;
+
+void video_mark_dirty_range(const uint16_t address, const uint32_t size)
+{
+    const uint32_t start
+        = address > VIDEO_RAM_START ? address : VIDEO_RAM_START;
+    uint32_t end = (uint32_t)address + size;
+    if(end > VIDEO_RAM_START + VIDEO_RAM_SIZE) {
+        end = VIDEO_RAM_START + VIDEO_RAM_SIZE;
+    }
+    if(start >= end) {
+        return;
+    }
+
+    const uint32_t last = (end - 1 - VIDEO_RAM_START) / VIDEO_BYTES_PER_LINE;
+    for(uint32_t line = (start - VIDEO_RAM_START) / VIDEO_BYTES_PER_LINE;
+        line <= last; line++) {
+        video_dirty_lines[line / 32] |= (1U << (line % 32));
+    }
+}
+
+void video_init()
+{
+    for(int i = 0; i < 2; i++) {
+        for(int p = 0; p < VIDEO_WIDTH * VIDEO_HEIGHT; p++) {
+            frames[i][p] = VIDEO_BACKGROUND;
+        }
+    }
+    atomic_store(&front, 0);
+    atomic_store(&reading, NO_FRAME);
+    video_invalidate();
+}
+
+void video_invalidate()
+{
+    for(int w = 0; w < VIDEO_DIRTY_WORDS; w++) {
+        video_dirty_lines[w] = 0xFFFFFFFFU;
+    }
+}
+
+// Converts 8 adjacent lines starting at x0. Bit k of byte j of every line
+// lands on the same screen row, so each row gets 8 contiguous pixels and
+// the rotation needs no strided stores.
+static void render_group(const uint8_t* memory, uint32_t* frame, const int x0)
+{
+    const uint8_t* lines
+        = &memory[VIDEO_RAM_START + x0 * VIDEO_BYTES_PER_LINE];
+#if defined(__AVX2__)
+    const __m256i foreground = _mm256_set1_epi32((int)VIDEO_FOREGROUND);
+    const __m256i background = _mm256_set1_epi32((int)VIDEO_BACKGROUND);
+#elif defined(__SSE2__)
+    const __m128i foreground = _mm_set1_epi32((int)VIDEO_FOREGROUND);
+    const __m128i background = _mm_set1_epi32((int)VIDEO_BACKGROUND);
+#endif
+
+    for(int j = 0; j < VIDEO_BYTES_PER_LINE; j++) {
+        const uint8_t* column = &lines[j];
+        // Video RAM lines run up the screen, the first bit is at the bottom
+        uint32_t* row = &frame[(VIDEO_HEIGHT - 1 - j * 8) * VIDEO_WIDTH + x0];
+#if defined(__AVX2__)
+        const __m256i bytes = _mm256_setr_epi32(
+            column[0 * VIDEO_BYTES_PER_LINE], column[1 * VIDEO_BYTES_PER_LINE],
+            column[2 * VIDEO_BYTES_PER_LINE], column[3 * VIDEO_BYTES_PER_LINE],
+            column[4 * VIDEO_BYTES_PER_LINE], column[5 * VIDEO_BYTES_PER_LINE],
+            column[6 * VIDEO_BYTES_PER_LINE],
+            column[7 * VIDEO_BYTES_PER_LINE]);
+        for(int bit = 0; bit < 8; bit++, row -= VIDEO_WIDTH) {
+            const __m256i mask = _mm256_set1_epi32(1 << bit);
+            const __m256i set
+                = _mm256_cmpeq_epi32(_mm256_and_si256(bytes, mask), mask);
+            _mm256_storeu_si256(
+                (__m256i*)row, _mm256_blendv_epi8(background, foreground, set));
+        }
+#elif defined(__SSE2__)
+        const __m128i low_bytes = _mm_setr_epi32(
+            column[0 * VIDEO_BYTES_PER_LINE], column[1 * VIDEO_BYTES_PER_LINE],
+            column[2 * VIDEO_BYTES_PER_LINE], column[3 * VIDEO_BYTES_PER_LINE]);
+        const __m128i high_bytes = _mm_setr_epi32(
+            column[4 * VIDEO_BYTES_PER_LINE], column[5 * VIDEO_BYTES_PER_LINE],
+            column[6 * VIDEO_BYTES_PER_LINE], column[7 * VIDEO_BYTES_PER_LINE]);
+        for(int bit = 0; bit < 8; bit++, row -= VIDEO_WIDTH) {
+            const __m128i mask = _mm_set1_epi32(1 << bit);
+            const __m128i low
+                = _mm_cmpeq_epi32(_mm_and_si128(low_bytes, mask), mask);
+            const __m128i high
+                = _mm_cmpeq_epi32(_mm_and_si128(high_bytes, mask), mask);
+            _mm_storeu_si128((__m128i*)row,
+                             _mm_or_si128(_mm_and_si128(low, foreground),
+                                          _mm_andnot_si128(low, background)));
+            _mm_storeu_si128((__m128i*)&row[4],
+                             _mm_or_si128(_mm_and_si128(high, foreground),
+                                          _mm_andnot_si128(high, background)));
+        }
+#else
+        for(int bit = 0; bit < 8; bit++, row -= VIDEO_WIDTH) {
+            for(int i = 0; i < VIDEO_GROUP_LINES; i++) {
+                row[i] = ((column[i * VIDEO_BYTES_PER_LINE] >> bit) & 1)
+                             ? VIDEO_FOREGROUND
+                             : VIDEO_BACKGROUND;
+            }
+        }
+#endif
+    }
+}
+
+bool video_render(const uint8_t* memory)
+{
+    for(int w = 0; w < VIDEO_DIRTY_WORDS; w++) {
+        frame_dirty_lines[0][w] |= video_dirty_lines[w];
+        frame_dirty_lines[1][w] |= video_dirty_lines[w];
+        video_dirty_lines[w] = 0;
+    }
+
+    const int back = 1 - atomic_load(&front);
+    if(atomic_load(&reading) == back) {
+        return false;
+    }
+
+    // A group is converted when any of its lines is dirty
+    for(int g = 0; g < VIDEO_LINES / VIDEO_GROUP_LINES; g++) {
+        const int x0 = g * VIDEO_GROUP_LINES;
+        const uint32_t dirty = frame_dirty_lines[back][x0 / 32] >> (x0 % 32);
+        if((dirty & 0xFF) != 0) {
+            render_group(memory, frames[back], x0);
+        }
+    }
+    for(int w = 0; w < VIDEO_DIRTY_WORDS; w++) {
+        frame_dirty_lines[back][w] = 0;
+    }
+
+    atomic_store(&front, back);
+    return true;
+}
+
+const uint32_t* video_acquire_frame()
+{
+    // Re-check front after announcing the buffer, otherwise the emulation
+    // side could have started rendering into it in between
+    int index;
+    do {
+        index = atomic_load(&front);
+        atomic_store(&reading, index);
+    } while(atomic_load(&front) != index);
+
+    return frames[index];
+}
+
+void video_release_frame()
+{
+    atomic_store(&reading, NO_FRAME);
+}